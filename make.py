@@ -7,11 +7,13 @@ p.add_argument('-c', '--compiler', help='Compiler', choices=['cc', 'gcc', 'clang
 p.add_argument('-o', '--output', help='Output file', default='')
 p.add_argument('-d', '--debug', action='store_true', help='Debug compile')
 p.add_argument('-s', '--static', action='store_true', help='Static compile')
-p.add_argument('-p', '--task', help='Task to run', choices=['main', 'test', 'engine'], default='main')
+p.add_argument('-n', '--native', action='store_true', help='Compile for this machine (enables PEXT sliding attacks on BMI2 hardware)')
+p.add_argument('-p', '--task', help='Task to run', choices=['main', 'test', 'engine', 'bench'], default='main')
 args = p.parse_args()
 
 # Determine flags for: compilation, warning, and linking
-cflags = '-I./src -std=gnu11 -mpopcnt {}'.format('-DNDEBUG -Os -ffast-math -flto -s' if not args.debug else '-g -O1')
+cflags = '-I./src -std=gnu11 {} {}'.format('-march=native' if args.native else '-mpopcnt',
+    '-DNDEBUG -Os -ffast-math -flto -s' if not args.debug else '-g -O1')
 wflags = '-Wfatal-errors -Wall -Wextra -Wstrict-prototypes -Wsign-conversion -Wshadow -Wpadded'
 lflags ='-lpthread -lm'
 if args.static: lflags += ' -static'
@@ -23,16 +25,18 @@ def run(cmd):
 def compile(program, output):
     sources = 'src/bitboard.c src/gen.c src/position.c src/str.c src/util.c src/vec.c'
     if program == 'main':
-        sources += ' src/engine.c src/game.c src/jobs.c src/main.c src/openings.c src/options.c' \
-            ' src/seqwriter.c src/sprt.c src/workers.c'
+        sources += ' src/engine.c src/game.c src/jobs.c src/main.c src/net.c src/openings.c' \
+            ' src/options.c src/pool.c src/seqwriter.c src/sprt.c src/tb.c src/workers.c'
     elif program == 'engine':
         sources += ' test/engine.c'
+    elif program == 'bench':
+        sources += ' src/seqwriter.c test/bench.c'
 
     return run('{} {} {} {} -o {} {}'.format(args.compiler, cflags, wflags, sources, output, lflags))
 
 if args.task == 'test':
     if compile('engine', './test/engine') == 0 and compile('main', './c-chess-cli') == 0:
-        run('rm stdout* out*.pgn training.csv c-chess-cli.*.log log*')
+        run('rm stdout* out*.pgn training.csv c-chess-cli.*.log log* test/*.idx')
 
         print('\nRun tests:')
         run('./c-chess-cli -each cmd=./test/engine depth=6 option.Hash=4 ' \
@@ -58,3 +62,8 @@ elif args.task == 'main':
 elif args.task == 'engine':
     if args.output == '': args.output = './test/engine'
     compile(args.task, args.output)
+
+elif args.task == 'bench':
+    if args.output == '': args.output = './test/bench'
+    if compile(args.task, args.output) == 0:
+        run(args.output)
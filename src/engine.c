@@ -16,15 +16,16 @@
     #define _GNU_SOURCE
     #include <unistd.h>
     #include <fcntl.h>
-    #include <sys/prctl.h>
+    #include <sched.h>
+    #include <spawn.h>
 #else
     #include <unistd.h>
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <pthread.h>
-#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -34,6 +35,105 @@
 #include "util.h"
 #include "vec.h"
 
+// Timing statistics (-stats): one entry per engine name, shared by all workers. The mutex is taken
+// once per measurement (at most a few times per move), which is noise next to the pipe I/O.
+typedef struct {
+    int64_t count, total, min, max;
+    int64_t hist[16];  // log2 buckets in msec: [0] <= 1ms, [1] <= 2ms, ... [15] >= 32s
+} Stat;
+
+typedef struct {
+    str_t name;
+    Stat stat[NB_STAT];
+} EngineStats;
+
+static EngineStats *statsTable;  // NULL unless -stats
+static pthread_mutex_t statsMtx = PTHREAD_MUTEX_INITIALIZER;
+
+void engine_stats_enable(void)
+{
+    statsTable = vec_init(EngineStats);
+}
+
+static void stats_add(const char *name, int metric, int64_t ms)
+{
+    if (!statsTable)
+        return;
+
+    pthread_mutex_lock(&statsMtx);
+    EngineStats *es = NULL;
+
+    for (size_t i = 0; i < vec_size(statsTable); i++)
+        if (!strcmp(statsTable[i].name.buf, name)) {
+            es = &statsTable[i];
+            break;
+        }
+
+    if (!es) {
+        EngineStats fresh = {.name = str_init_from_c(name)};
+
+        for (int m = 0; m < NB_STAT; m++)
+            fresh.stat[m].min = INT64_MAX;
+
+        vec_push(statsTable, fresh);
+        es = &statsTable[vec_size(statsTable) - 1];
+    }
+
+    Stat *s = &es->stat[metric];
+    s->count++;
+    s->total += ms;
+    s->min = min(s->min, ms);
+    s->max = max(s->max, ms);
+    s->hist[ms <= 1 ? 0 : min(63 - __builtin_clzll((uint64_t)ms), 15)]++;
+    pthread_mutex_unlock(&statsMtx);
+}
+
+void engine_stats_print(void)
+{
+    if (!statsTable)
+        return;
+
+    static const char *labels[NB_STAT] = {"uci handshake", "isready round trip", "go -> bestmove",
+        "clock margin"};
+
+    for (size_t i = 0; i < vec_size(statsTable); i++) {
+        printf("Timing stats for %s:\n", statsTable[i].name.buf);
+
+        for (int m = 0; m < NB_STAT; m++) {
+            const Stat *s = &statsTable[i].stat[m];
+
+            if (!s->count)
+                continue;
+
+            printf("  %-18s n=%-8" PRId64 " mean=%.1fms min=%" PRId64 "ms max=%" PRId64 "ms\n",
+                labels[m], s->count, (double)s->total / (double)s->count, s->min, s->max);
+            printf("    histogram:");
+
+            for (int b = 0; b < 16; b++)
+                if (s->hist[b]) {
+                    // Bucket b covers [2^b, 2^(b+1)) msec; the first also catches <= 0
+                    if (b < 15)
+                        printf(" [<%ims: %" PRId64 "]", 2 << b, s->hist[b]);
+                    else
+                        printf(" [>=%ims: %" PRId64 "]", 1 << b, s->hist[b]);
+                }
+
+            puts("");
+        }
+    }
+}
+
+void engine_stats_destroy(void)
+{
+    if (statsTable) {
+        for (size_t i = 0; i < vec_size(statsTable); i++)
+            str_destroy(&statsTable[i].name);
+
+        vec_destroy(statsTable);
+        statsTable = NULL;
+    }
+}
+
 static void engine_spawn(const Worker *w, Engine *e, const char *cwd, const char *run, char **argv,
     bool readStdErr)
 {
@@ -46,53 +146,103 @@ static void engine_spawn(const Worker *w, Engine *e, const char *cwd, const char
 #ifdef __linux__
     DIE_IF(w->id, pipe2(outof, O_CLOEXEC) < 0);
     DIE_IF(w->id, pipe2(into, O_CLOEXEC) < 0);
+
+    // Spawn with posix_spawn(), whose cost does not depend on the parent's memory size, unlike
+    // fork(), which has to duplicate page tables (expensive when the parent holds gigabytes of
+    // buffered PGN text and opening indexes).
+    //
+    // For stderr we have 2 choices:
+    // - readStdErr=true: dump it into stdout, like doing '2>&1' in bash. This is useful, if we
+    // want to see error messages from engines in their respective log file (notably assert()
+    // writes to stderr). Of course, such error messages should not be UCI commands, otherwise we
+    // will be fooled into parsing them as such.
+    // - readStdErr=false: do nothing, which means stderr is inherited from the parent process.
+    // Typcically, this means all engines write their error messages to the terminal (unless
+    // redirected otherwise).
+    posix_spawn_file_actions_t actions;
+    DIE_IF(w->id, (errno = posix_spawn_file_actions_init(&actions)));
+    DIE_IF(w->id, (errno = posix_spawn_file_actions_adddup2(&actions, into[0], STDIN_FILENO)));
+    DIE_IF(w->id, (errno = posix_spawn_file_actions_adddup2(&actions, outof[1], STDOUT_FILENO)));
+
+    if (readStdErr)
+        DIE_IF(w->id, (errno = posix_spawn_file_actions_adddup2(&actions, outof[1],
+            STDERR_FILENO)));
+
+    // Set cwd as current directory, and execute run with argv[]
+    DIE_IF(w->id, (errno = posix_spawn_file_actions_addchdir_np(&actions, cwd)));
+    DIE_IF(w->id, (errno = posix_spawnp(&e->pid, run, &actions, NULL, argv, environ)));
+    DIE_IF(w->id, (errno = posix_spawn_file_actions_destroy(&actions)));
+    {
+        assert(e->pid > 0);
 #else
     DIE_IF(w->id, pipe(outof) < 0);
     DIE_IF(w->id, pipe(into) < 0);
-#endif
 
     DIE_IF(w->id, (e->pid = fork()) < 0);
 
     if (e->pid == 0) {
-#ifdef __linux__
-        prctl(PR_SET_PDEATHSIG, SIGHUP);  // delegate zombie purge to the kernel
-#endif
         // Plug stdin and stdout
         DIE_IF(w->id, dup2(into[0], STDIN_FILENO) < 0);
         DIE_IF(w->id, dup2(outof[1], STDOUT_FILENO) < 0);
 
-        // For stderr we have 2 choices:
-        // - readStdErr=true: dump it into stdout, like doing '2>&1' in bash. This is useful, if we
-        // want to see error messages from engines in their respective log file (notably assert()
-        // writes to stderr). Of course, such error messages should not be UCI commands, otherwise we
-        // will be fooled into parsing them as such.
-        // - readStdErr=false: do nothing, which means stderr is inherited from the parent process.
-        // Typcically, this means all engines write their error messages to the terminal (unless
-        // redirected otherwise).
+        // See the Linux branch above for the meaning of readStdErr
         if (readStdErr)
             DIE_IF(w->id, dup2(outof[1], STDERR_FILENO) < 0);
 
-#ifndef __linux__
         // Ugly (and slow) workaround for non-Linux POSIX systems that lack the ability to
         // atomically set O_CLOEXEC when creating pipes.
         for (int fd = 3; fd < sysconf(FOPEN_MAX); close(fd++));
-#endif
 
         // Set cwd as current directory, and execute run with argv[]
         DIE_IF(w->id, chdir(cwd) < 0);
         DIE_IF(w->id, execvp(run, argv) < 0);
     } else {
         assert(e->pid > 0);
+#endif
 
         // in the parent process
         DIE_IF(w->id, close(into[0]) < 0);
         DIE_IF(w->id, close(outof[1]) < 0);
 
-        DIE_IF(w->id, !(e->in = fdopen(outof[0], "r")));
+        // The reading end is a raw fd, buffered by inBuf, so that a single read() syscall drains
+        // whatever the engine wrote (typically many info lines at once). stdio would cost a function
+        // call per character, and matters at high concurrency, where tester cores are scarce.
+        e->in = outof[0];
+        e->inAlloc = 4096;
+        e->inBuf = malloc(e->inAlloc);
+        e->inLen = e->inPos = 0;
+
         DIE_IF(w->id, !(e->out = fdopen(into[1], "w")));
     }
 }
 
+static size_t engine_fill(const Worker *w, Engine *e)
+// Reads more engine output into e->inBuf, growing it as needed. Returns the number of bytes read,
+// which is zero only on EOF (ie. engine died).
+{
+    // Discard consumed bytes, to make room at the end of the buffer
+    if (e->inPos) {
+        memmove(e->inBuf, e->inBuf + e->inPos, e->inLen - e->inPos);
+        e->inLen -= e->inPos;
+        e->inPos = 0;
+    }
+
+    if (e->inLen == e->inAlloc) {
+        e->inAlloc *= 2;
+        e->inBuf = realloc(e->inBuf, e->inAlloc);
+    }
+
+    ssize_t n;
+
+    do {
+        n = read(e->in, e->inBuf + e->inLen, e->inAlloc - e->inLen);
+    } while (n < 0 && errno == EINTR);
+
+    DIE_IF(w->id, n < 0);
+    e->inLen += (size_t)n;
+    return (size_t)n;
+}
+
 static void engine_parse_cmd(const char *cmd, str_t *cwd, str_t *run, str_t **args)
 {
     // Isolate the first token being the command to run.
@@ -128,6 +278,7 @@ Engine engine_init(Worker *w, const char *cmd, const char *name, const str_t *op
 
     Engine e = {0};
     e.name = str_init_from_c(*name ? name : cmd); // default value
+    const int64_t handshakeStart = system_msec();
 
     // Parse cmd into (cwd, run, args): we want to execute run from cwd with args.
     scope(str_destroy) str_t cwd = str_init(), run = str_init();
@@ -165,6 +316,7 @@ Engine engine_init(Worker *w, const char *cmd, const char *name, const str_t *op
     } while (strcmp(line.buf, "uciok"));
 
     deadline_clear(w);
+    stats_add(e.name.buf, STAT_HANDSHAKE, system_msec() - handshakeStart);
 
     for (size_t i = 0; i < vec_size(options); i++) {
         scope(str_destroy) str_t oname = str_init(), ovalue = str_init();
@@ -176,6 +328,26 @@ Engine engine_init(Worker *w, const char *cmd, const char *name, const str_t *op
     return e;
 }
 
+// Pin the engine process to a single cpu, for stable nps and fair time usage on big machines
+// (Linux only, no-op elsewhere or when cpu < 0). Called right after spawning, so the pin lands
+// before the engine starts searching; re-applied when a parked engine changes worker.
+void engine_pin(Worker *w, const Engine *e, int cpu)
+{
+#ifdef __linux__
+    if (cpu < 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET((size_t)cpu, &set);
+    DIE_IF(w->id, sched_setaffinity(e->pid, sizeof(set), &set) < 0);
+
+    worker_log(w, "pinned %S to cpu %i\n", e->name, cpu);
+#else
+    (void)w, (void)e, (void)cpu;
+#endif
+}
+
 void engine_destroy(Worker *w, Engine *e)
 {
     // Order the engine to quit, and grant 1s deadline for obeying
@@ -185,34 +357,43 @@ void engine_destroy(Worker *w, Engine *e)
     deadline_clear(w);
 
     str_destroy(&e->name);
-    DIE_IF(w->id, fclose(e->in) < 0);
+    free(e->inBuf);
+    DIE_IF(w->id, close(e->in) < 0);
     DIE_IF(w->id, fclose(e->out) < 0);
 }
 
-void engine_readln(const Worker *w, const Engine *e, str_t *line)
+void engine_readln(Worker *w, Engine *e, str_t *line)
 {
-    if (!str_getline(line, e->in))
-        DIE("[%d] could not read from %s\n", w->id, e->name.buf);
+    while (true) {
+        const char *lf = memchr(e->inBuf + e->inPos, '\n', e->inLen - e->inPos);
+
+        if (lf) {
+            const size_t n = (size_t)(lf - (e->inBuf + e->inPos));
+            str_ncpy(line, (str_t){.buf = e->inBuf + e->inPos, .len = n, .alloc = n + 1}, n);
+            e->inPos += n + 1;
+            break;
+        }
 
-    if (w->log)
-        DIE_IF(w->id, fprintf(w->log, "%s -> %s\n", e->name.buf, line->buf) < 0);
+        if (!engine_fill(w, e))
+            DIE("[%d] could not read from %s\n", w->id, e->name.buf);
+    }
+
+    worker_log(w, "%s -> %s\n", e->name.buf, line->buf);
 }
 
-void engine_writeln(const Worker *w, const Engine *e, char *buf)
+void engine_writeln(Worker *w, const Engine *e, char *buf)
 {
     DIE_IF(w->id, fputs(buf, e->out) < 0);
     DIE_IF(w->id, fputc('\n', e->out) < 0);
     DIE_IF(w->id, fflush(e->out) < 0);
 
-    if (w->log) {
-        DIE_IF(w->id, fprintf(w->log, "%s <- %s\n", e->name.buf, buf) < 0);
-        DIE_IF(w->id, fflush(w->log) < 0);
-    }
+    worker_log(w, "%s <- %s\n", e->name.buf, buf);
 }
 
-void engine_sync(Worker *w, const Engine *e)
+void engine_sync(Worker *w, Engine *e)
 {
-    deadline_set(w, e->name.buf, system_msec() + 2000);
+    const int64_t start = system_msec();
+    deadline_set(w, e->name.buf, start + 2000);
     engine_writeln(w, e, "isready");
     scope(str_destroy) str_t line = str_init();
 
@@ -221,48 +402,74 @@ void engine_sync(Worker *w, const Engine *e)
     } while (strcmp(line.buf, "readyok"));
 
     deadline_clear(w);
+    stats_add(e->name.buf, STAT_SYNC, system_msec() - start);
+}
+
+static void engine_parse_info(const str_t *line, str_t *pv, Info *info)
+// Scans an info line in place, extracting only depth, score and pv. Walks the line word by word
+// with pointer arithmetic: engines at high depth emit thousands of info lines per move, and the
+// generic str_tok() tokenizer (one str_t copy per token) showed up in tester profiles.
+{
+    const char *tail = line->buf + strlen("info ");
+
+    while (*tail) {
+        const char *next = NULL;
+
+        if ((next = str_prefix(tail, "depth ")))
+            info->depth = atoi(next);
+        else if ((next = str_prefix(tail, "score cp ")))
+            info->score = atoi(next);
+        else if ((next = str_prefix(tail, "score mate "))) {
+            const int movesToMate = atoi(next);
+            info->score = movesToMate < 0 ? INT_MIN - movesToMate : INT_MAX - movesToMate;
+        } else if (str_prefix(tail, "score "))
+            DIE("illegal syntax after 'score' in '%s'\n", line->buf);
+        else if ((next = str_prefix(tail, "pv "))) {
+            // pv extends to the end of the line
+            if (pv)
+                str_cpy_c(pv, next + strspn(next, " "));
+
+            return;
+        }
+
+        // Skip to the next word (values of matched fields are just words, skipped the same way)
+        tail = next ? next : tail;
+        tail += strcspn(tail, " ");
+        tail += strspn(tail, " ");
+    }
 }
 
-bool engine_bestmove(Worker *w, const Engine *e, int64_t *timeLeft, str_t *best, str_t *pv,
-    Info *info)
+bool engine_bestmove(Worker *w, Engine *e, int64_t *timeLeft, str_t *best, str_t *pv,
+    Info *info, bool parseInfo)
 {
     int result = false;
-    scope(str_destroy) str_t line = str_init(), token = str_init();
-    str_clear(pv);
+    scope(str_destroy) str_t line = str_init();
+
+    if (pv)
+        str_clear(pv);
 
-    const int64_t start = system_msec(), timeLimit = start + *timeLeft;
-    deadline_set(w, e->name.buf, timeLimit + 1000);
+    // The clock runs in nsec: at very fast time controls, msec quantization (plus pipe transit)
+    // systematically overcharges fast engines, and forfeits games that were won on time. The
+    // watchdog deadline stays in msec — same clock, coarser unit.
+    const int64_t start = system_nsec(), timeLimit = start + *timeLeft;
+    deadline_set(w, e->name.buf, timeLimit / 1000000 + 1000);
 
     while (*timeLeft >= 0 && !result) {
         engine_readln(w, e, &line);
 
-        const int64_t now = system_msec();
-        info->time = now - start;
+        const int64_t now = system_nsec();
+        info->time = (now - start) / 1000000;  // Info.time stays in msec (PGN comments)
         *timeLeft = timeLimit - now;
 
         const char *tail = NULL;
 
-        if ((tail = str_prefix(line.buf, "info "))) {
-            while ((tail = str_tok(tail, &token, " "))) {
-                if (!strcmp(token.buf, "depth")) {
-                    if ((tail = str_tok(tail, &token, " ")))
-                        info->depth = atoi(token.buf);
-                } else if (!strcmp(token.buf, "score")) {
-                    if ((tail = str_tok(tail, &token, " "))) {
-                        if (!strcmp(token.buf, "cp") && (tail = str_tok(tail, &token, " ")))
-                            info->score = atoi(token.buf);
-                        else if (!strcmp(token.buf, "mate") && (tail = str_tok(tail, &token, " "))) {
-                            const int movesToMate = atoi(token.buf);
-                            info->score = movesToMate < 0 ? INT_MIN - movesToMate : INT_MAX - movesToMate;
-                        } else
-                            DIE("illegal syntax after 'score' in '%s'\n", line.buf);
-                    }
-                } else if (!strcmp(token.buf, "pv"))
-                    str_cpy_c(pv, tail + strspn(tail, " "));
-            }
+        if (str_prefix(line.buf, "info ")) {
+            // Skip the parse entirely when neither adjudication, sampling, nor PGN comments need it
+            if (parseInfo)
+                engine_parse_info(&line, pv, info);
         } else if ((tail = str_prefix(line.buf, "bestmove "))) {
-            str_tok(tail, &token, " ");
-            str_cpy(best, token);
+            tail += strspn(tail, " ");
+            str_ncpy(best, str_ref(tail), strcspn(tail, " "));
             result = true;
         }
     }
@@ -278,5 +485,11 @@ bool engine_bestmove(Worker *w, const Engine *e, int64_t *timeLeft, str_t *best,
     }
 
     deadline_clear(w);
+    stats_add(e->name.buf, STAT_BESTMOVE, (system_nsec() - start) / 1000000);
+
+    // Clock margin only makes sense under a real time limit (not the depth/nodes HACK value)
+    if (*timeLeft < INT64_MAX / 4)
+        stats_add(e->name.buf, STAT_MARGIN, *timeLeft / 1000000);
+
     return result;
 }
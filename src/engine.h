@@ -22,11 +22,14 @@
 
 // Engine process
 typedef struct {
-    FILE *in, *out;
+    FILE *out;  // writing end of the pipe (buffered, flushed at each line)
+    char *inBuf;  // buffer for the reading end of the pipe
+    size_t inAlloc, inLen, inPos;  // allocated size, bytes buffered, bytes consumed
     str_t name;
     pid_t pid;
+    int in;  // reading end of the pipe (raw fd, buffered by inBuf)
     bool supportChess960;
-    char pad[3];
+    char pad[7];
 } Engine;
 
 // Elements remembered from parsing info lines (for writing PGN comments)
@@ -35,12 +38,30 @@ typedef struct {
     int64_t time;
 } Info;
 
+// Per-engine timing metrics (-stats), aggregated across workers and dumped at the end of the run.
+// Tells slow engines from a slow tester when games/hour degrades.
+enum {
+    STAT_HANDSHAKE,  // spawn + uci -> uciok
+    STAT_SYNC,  // isready -> readyok round trip
+    STAT_BESTMOVE,  // go -> bestmove latency
+    STAT_MARGIN,  // clock margin: time left when bestmove arrived (negative = forfeit)
+    NB_STAT
+};
+
+void engine_stats_enable(void);
+void engine_stats_print(void);
+void engine_stats_destroy(void);
+
 Engine engine_init(Worker *w, const char *cmd, const char *name, const str_t *options);
+void engine_pin(Worker *w, const Engine *e, int cpu);
 void engine_destroy(Worker *w, Engine *e);
 
-void engine_readln(const Worker *w, const Engine *e, str_t *line);
-void engine_writeln(const Worker *w, const Engine *e, char *buf);
+void engine_readln(Worker *w, Engine *e, str_t *line);
+void engine_writeln(Worker *w, const Engine *e, char *buf);
+
+void engine_sync(Worker *w, Engine *e);
 
-void engine_sync(Worker *w, const Engine *e);
-bool engine_bestmove(Worker *w, const Engine *e, int64_t *timeLeft, str_t *best, str_t *pv,
-    Info *info);
+// Waits for bestmove, within *timeLeft (in nsec). If parseInfo, fills 'info' (and 'pv', unless
+// NULL) from the info lines along the way; otherwise info lines are discarded unparsed.
+bool engine_bestmove(Worker *w, Engine *e, int64_t *timeLeft, str_t *best, str_t *pv,
+    Info *info, bool parseInfo);
@@ -13,32 +13,104 @@
  * not, see <http://www.gnu.org/licenses/>.
 */
 #include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include "game.h"
 #include "gen.h"
+#include "tb.h"
 #include "util.h"
 #include "vec.h"
 
-static void uci_position_command(const Game *g, str_t *cmd)
-// Builds a string of the form "position fen ... [moves ...]". Implements rule50 pruning: start from
-// the last position that reset the rule50 counter, to reduce the move list to the minimum, without
-// losing information.
+// Optional sample deduplication: a fixed-size, lock-free hash set of position keys, shared by all
+// workers. Openings and early middlegame positions recur across games by the millions, inflating
+// sample files and downstream shuffle cost. Memory is bounded: when a probe window fills up, the
+// incoming key overwrites an old one, so the filter is approximate — an occasional duplicate gets
+// through, but no first-seen position is ever dropped.
+static atomic_uint_least64_t *dedupSet;
+static size_t dedupMask;  // number of slots - 1 (power of 2)
+
+void game_sample_dedup_init(int mb)
 {
-    // Index of the starting FEN, where rule50 was last reset
-    const int ply0 = max(g->ply - g->pos[g->ply].rule50, 0);
+    size_t slots = 1;
 
-    scope(str_destroy) str_t fen = str_init();
-    pos_get(&g->pos[ply0], &fen, g->sfen);
-    str_cpy_fmt(cmd, "position fen %S", fen);
+    while (slots * 2 * sizeof(*dedupSet) <= (size_t)mb << 20)
+        slots *= 2;
+
+    DIE_IF(0, !(dedupSet = calloc(slots, sizeof(*dedupSet))));
+    dedupMask = slots - 1;
+}
+
+void game_sample_dedup_destroy(void)
+{
+    free(dedupSet);
+    dedupSet = NULL;
+}
+
+static bool sample_seen(uint64_t key)
+// Returns true if key is already in the set, and inserts it otherwise
+{
+    if (!dedupSet)
+        return false;
+
+    const size_t start = key & dedupMask;
+
+    for (size_t i = 0; i < 16; i++) {
+        const size_t slot = (start + i) & dedupMask;
+        uint64_t expected = 0;
+
+        if (atomic_compare_exchange_strong(&dedupSet[slot], &expected, key))
+            return false;  // claimed an empty slot: first sighting
+
+        if (expected == key)
+            return true;
+    }
+
+    // Probe window full: overwrite, forgetting an old key
+    atomic_store(&dedupSet[start], key);
+    return false;
+}
 
-    if (ply0 < g->ply) {
+static void uci_position_command(Game *g)
+// Maintains g->posCmd, a string of the form "position fen ... [moves ...]". Implements rule50
+// pruning: start from the last position that reset the rule50 counter, to reduce the move list to
+// the minimum, without losing information. The command is cached across plies: as long as rule50
+// keeps counting up, the FEN prefix is unchanged, so only the new move needs appending. A full
+// rebuild (quadratic over the game) only happens when rule50 resets.
+{
+    if (g->ply == g->posCmdPly + 1 && g->posCmdPly >= 0 && g->pos[g->ply].rule50 > 0) {
+        // Same starting FEN as last ply: append the move just played. Whether the "moves" keyword
+        // is already in place is tracked explicitly: it cannot be inferred from the rule50
+        // counter, because an opening FEN may start with a nonzero halfmove clock.
         scope(str_destroy) str_t lan = str_init();
-        str_cat_c(cmd, " moves");
+        pos_move_to_lan(&g->pos[g->ply - 1], g->pos[g->ply].lastMove, &lan);
+
+        if (!g->posCmdMoves) {
+            str_cat_c(&g->posCmd, " moves");
+            g->posCmdMoves = true;
+        }
 
-        for (int ply = ply0 + 1; ply <= g->ply; ply++) {
-            pos_move_to_lan(&g->pos[ply - 1], g->pos[ply].lastMove, &lan);
-            str_cat(str_push(cmd, ' '), lan);
+        str_cat(str_push(&g->posCmd, ' '), lan);
+    } else {
+        // Index of the starting FEN, where rule50 was last reset
+        const int ply0 = max(g->ply - g->pos[g->ply].rule50, 0);
+
+        scope(str_destroy) str_t fen = str_init();
+        pos_get(&g->pos[ply0], &fen, g->sfen);
+        str_cpy_fmt(&g->posCmd, "position fen %S", fen);
+        g->posCmdMoves = ply0 < g->ply;
+
+        if (g->posCmdMoves) {
+            scope(str_destroy) str_t lan = str_init();
+            str_cat_c(&g->posCmd, " moves");
+
+            for (int ply = ply0 + 1; ply <= g->ply; ply++) {
+                pos_move_to_lan(&g->pos[ply - 1], g->pos[ply].lastMove, &lan);
+                str_cat(str_push(&g->posCmd, ' '), lan);
+            }
         }
     }
+
+    g->posCmdPly = g->ply;
 }
 
 static void uci_go_command(Game *g, const EngineOptions *eo[2], int ei, const int64_t timeLeft[2],
@@ -52,15 +124,17 @@ static void uci_go_command(Game *g, const EngineOptions *eo[2], int ei, const in
     if (eo[ei]->depth)
         str_cat_fmt(cmd, " depth %i", eo[ei]->depth);
 
+    // Clocks are tracked in nsec, but UCI speaks msec: round down, so an engine is never promised
+    // time it does not have
     if (eo[ei]->movetime)
-        str_cat_fmt(cmd, " movetime %I", eo[ei]->movetime);
+        str_cat_fmt(cmd, " movetime %I", eo[ei]->movetime / 1000000);
 
     if (eo[ei]->time || eo[ei]->increment) {
         const int color = g->pos[g->ply].turn;
 
         str_cat_fmt(cmd, " wtime %I winc %I btime %I binc %I",
-            timeLeft[ei ^ color], eo[ei ^ color]->increment,
-            timeLeft[ei ^ color ^ BLACK], eo[ei ^ color ^ BLACK]->increment);
+            timeLeft[ei ^ color] / 1000000, eo[ei ^ color]->increment / 1000000,
+            timeLeft[ei ^ color ^ BLACK] / 1000000, eo[ei ^ color ^ BLACK]->increment / 1000000);
     }
 
     if (eo[ei]->movestogo)
@@ -103,7 +177,7 @@ static bool illegal_move(move_t move, const move_t *moves)
     return true;
 }
 
-static Position resolve_pv(const Worker *w, const Game *g, const char *pv)
+static Position resolve_pv(Worker *w, const Game *g, const char *pv, move_t **moves)
 {
     scope(str_destroy) str_t token = str_init();
     const char *tail = pv;
@@ -115,20 +189,16 @@ static Position resolve_pv(const Worker *w, const Game *g, const char *pv)
     Position p[2];
     p[0] = resolved;
     int idx = 0;
-    move_t *moves = vec_init_reserve(64, move_t);
 
     while ((tail = str_tok(tail, &token, " "))) {
         const move_t m = pos_lan_to_move(&p[idx], token.buf);
-        moves = gen_all_moves(&p[idx], moves);
+        *moves = gen_all_moves(&p[idx], *moves);
 
-        if (illegal_move(m, moves)) {
+        if (illegal_move(m, *moves)) {
             printf("[%d] WARNING: Illegal move in PV '%s%s' from %s\n", w->id, token.buf, tail,
                 g->names[g->pos[g->ply].turn].buf);
 
-            if (w->log)
-                DIE_IF(w->id, fprintf(w->log, "WARNING: illegal move in PV '%s%s'\n", token.buf,
-                    tail) < 0);
-
+            worker_log(w, "WARNING: illegal move in PV '%s%s'\n", token.buf, tail);
             break;
         }
 
@@ -139,7 +209,6 @@ static Position resolve_pv(const Worker *w, const Game *g, const char *pv)
             resolved = p[idx];
     }
 
-    vec_destroy(moves);
     return resolved;
 }
 
@@ -157,9 +226,36 @@ Game game_init(int round, int game)
     g.info = vec_init(Info);
     g.samples = vec_init(Sample);
 
+    g.posCmd = str_init();
+    g.posCmdPly = -1;
+
     return g;
 }
 
+// Reuse a Game for the next job: clear the contents, but keep the buffers, whose capacity stays at
+// the high-water mark across the worker's run. Saves a malloc/realloc storm per game (the Position
+// vector alone regrows past 100 elements of ~112 bytes in a typical game).
+void game_reset(Game *g, int round, int game)
+{
+    g->round = round;
+    g->game = game;
+    g->ply = 0;
+    g->state = STATE_NONE;
+    g->tbResult = 0;
+    g->sfen = false;
+
+    str_clear(&g->names[WHITE]);
+    str_clear(&g->names[BLACK]);
+
+    str_clear(&g->posCmd);
+    g->posCmdPly = -1;
+    g->posCmdMoves = false;
+
+    vec_clear(g->pos);
+    vec_clear(g->info);
+    vec_clear(g->samples);
+}
+
 bool game_load_fen(Game *g, const char *fen, int *color)
 {
     vec_push(g->pos, (Position){0});
@@ -171,16 +267,24 @@ bool game_load_fen(Game *g, const char *fen, int *color)
         return false;
 }
 
+void game_load_pos(Game *g, const Position *pos, bool sfen, int *color)
+// Binary book path: the position was validated when the book was made, no FEN parsing needed
+{
+    vec_push(g->pos, *pos);
+    g->sfen = sfen;
+    *color = pos->turn;
+}
+
 void game_destroy(Game *g)
 {
     vec_destroy(g->samples);
     vec_destroy(g->info);
     vec_destroy(g->pos);
 
-    str_destroy_n(&g->names[WHITE], &g->names[BLACK]);
+    str_destroy_n(&g->names[WHITE], &g->names[BLACK], &g->posCmd);
 }
 
-int game_play(Worker *w, Game *g, const Options *o, const Engine engines[2],
+int game_play(Worker *w, Game *g, const Options *o, Engine engines[2],
     const EngineOptions *eo[2], bool reverse)
 // Play a game:
 // - engines[reverse] plays the first move (which does not mean white, that depends on the FEN)
@@ -210,6 +314,13 @@ int game_play(Worker *w, Game *g, const Options *o, const Engine engines[2],
     int64_t timeLeft[2] = {eo[0]->time, eo[1]->time};
     scope(str_destroy) str_t pv = str_init();
     move_t *legalMoves = vec_init_reserve(64, move_t);
+    move_t *pvMoves = vec_init_reserve(64, move_t);  // scratch buffer for resolve_pv()
+
+    // Parse info lines only when something consumes them: adjudication rules, sampling, or PGN
+    // comments. The PV is only ever used for sample resolution.
+    const bool parseInfo = o->drawCount || o->resignCount || o->sampleFrequency > 0
+        || (o->pgn.len && o->pgnVerbosity >= 2);
+    const bool parsePv = o->sampleFrequency > 0 && o->sampleResolvePv;
 
     for (g->ply = 0; ; ei = 1 - ei, g->ply++) {
         if (played)
@@ -218,9 +329,22 @@ int game_play(Worker *w, Game *g, const Options *o, const Engine engines[2],
         if ((g->state = game_apply_chess_rules(g, &legalMoves)))
             break;
 
-        uci_position_command(g, &cmd);
-        engine_writeln(w, &engines[ei], cmd.buf);
-        engine_sync(w, &engines[ei]);
+        // Endgame table adjudication: stop as soon as the position is provably decided, instead of
+        // burning engine clock until a mate, 50-move or repetition terminal
+        if (o->tb && tb_probe(&g->pos[g->ply], &g->tbResult)) {
+            g->state = STATE_TB_ADJUDICATION;
+            break;
+        }
+
+        uci_position_command(g);
+        engine_writeln(w, &engines[ei], g->posCmd.buf);
+
+        // In pipelined mode, send 'position' and 'go' back-to-back: UCI engines process commands in
+        // order, so the isready round trip before each 'go' only adds a per-move latency floor
+        // (pipe write, engine wakeup, pipe read), which distorts very fast time controls. The sync
+        // at the ucinewgame boundary above is kept, where it is semantically required.
+        if (!o->pipeline)
+            engine_sync(w, &engines[ei]);
 
         // Prepare timeLeft[ei]
         if (eo[ei]->movetime)
@@ -235,20 +359,16 @@ int game_play(Worker *w, Game *g, const Options *o, const Engine engines[2],
                 timeLeft[ei] += eo[ei]->time;
         } else
             // Only depth and/or nodes limit
-            timeLeft[ei] = INT64_MAX / 2;  // HACK: system_msec() + timeLeft must not overflow
+            timeLeft[ei] = INT64_MAX / 2;  // HACK: system_nsec() + timeLeft must not overflow
 
         uci_go_command(g, eo, ei, timeLeft, &cmd);
         engine_writeln(w, &engines[ei], cmd.buf);
 
         Info info = {0};
-        const bool ok = engine_bestmove(w, &engines[ei], &timeLeft[ei], &best, &pv, &info);
+        const bool ok = engine_bestmove(w, &engines[ei], &timeLeft[ei], &best,
+            parsePv ? &pv : NULL, &info, parseInfo);
         vec_push(g->info, info);
 
-        // Parses the last PV sent. An invalid PV is not fatal, but logs some warnings. Keep track
-        // of the resolved position, which is the last in the PV that is not in check (or the
-        // current one if that's impossible).
-        Position resolved = resolve_pv(w, g, pv.buf);
-
         if (!ok) {  // engine_bestmove() time out before parsing a bestmove
             g->state = STATE_TIME_LOSS;
             break;
@@ -284,17 +404,22 @@ int game_play(Worker *w, Game *g, const Options *o, const Engine engines[2],
         } else
             resignCount[ei] = 0;
 
-        // Write sample: position (compactly encoded) + score
+        // Write sample: position (compactly encoded) + score. Parses the last PV sent; an invalid
+        // PV is not fatal, but logs some warnings. The resolved position is the last in the PV that
+        // is not in check (or the current one if that's impossible). Resolution only runs for plies
+        // that actually produce a sample: for all others it is wasted work (a gen_all_moves call
+        // and two Position copies per PV token).
         if (prngf(&w->seed) <= o->sampleFrequency) {
             Sample sample = {
-                .pos = o->sampleResolvePv ? resolved : g->pos[g->ply],
+                .pos = parsePv ? resolve_pv(w, g, pv.buf, &pvMoves) : g->pos[g->ply],
                 .score = info.score,
                 .result = NB_RESULT // unknown yet (use invalid state for now)
             };
 
             // Record sample, except if resolvePv=true and the position is in check (becuase PV
-            // resolution couldn't avoid it), in which case the sample is discarded.
-            if (!o->sampleResolvePv || !sample.pos.checkers)
+            // resolution couldn't avoid it), or if deduplication is on and the position was
+            // already sampled, in which cases the sample is discarded.
+            if ((!o->sampleResolvePv || !sample.pos.checkers) && !sample_seen(sample.pos.key))
                 vec_push(g->samples, sample);
         }
 
@@ -303,15 +428,24 @@ int game_play(Worker *w, Game *g, const Options *o, const Engine engines[2],
 
     assert(g->state != STATE_NONE);
     vec_destroy(legalMoves);
+    vec_destroy(pvMoves);
 
-    // Signed result from white's pov: -1 (loss), 0 (draw), +1 (win)
-    const int wpov = g->state < STATE_SEPARATOR
-        ? (g->pos[g->ply].turn == WHITE ? RESULT_LOSS : RESULT_WIN)  // lost from turn's pov
-        : RESULT_DRAW;
+    // Result from white's pov: RESULT_LOSS/DRAW/WIN. TB adjudication can go either way, given by
+    // tbResult (from the side to move's pov); every other decisive state is a loss for the turn.
+    const int wpov = g->state == STATE_TB_ADJUDICATION
+        ? (!g->tbResult ? RESULT_DRAW
+            : (g->tbResult > 0) == (g->pos[g->ply].turn == WHITE) ? RESULT_WIN : RESULT_LOSS)
+        : g->state < STATE_SEPARATOR
+            ? (g->pos[g->ply].turn == WHITE ? RESULT_LOSS : RESULT_WIN)  // lost from turn's pov
+            : RESULT_DRAW;
 
     for (size_t i = 0; i < vec_size(g->samples); i++)
         g->samples[i].result = g->samples[i].pos.turn == WHITE ? wpov : 2 - wpov;
 
+    if (g->state == STATE_TB_ADJUDICATION)
+        return !g->tbResult ? RESULT_DRAW
+            : (g->tbResult > 0) == (ei == 0) ? RESULT_WIN : RESULT_LOSS;
+
     return g->state < STATE_SEPARATOR
         ? (ei == 0 ? RESULT_LOSS : RESULT_WIN)  // engine on the move has lost
         : RESULT_DRAW;
@@ -341,6 +475,12 @@ void game_decode_state(const Game *g, str_t *result, str_t *reason)
         str_cpy_c(reason, "rules infraction");
     } else if (g->state == STATE_DRAW_ADJUDICATION)
         str_cpy_c(reason, "adjudication");
+    else if (g->state == STATE_TB_ADJUDICATION) {
+        if (g->tbResult)
+            str_cpy_c(result, (g->tbResult > 0) == (g->pos[g->ply].turn == WHITE) ? "1-0" : "0-1");
+
+        str_cpy_c(reason, "tb adjudication");
+    }
     else if (g->state == STATE_RESIGN) {
         str_cpy_c(result, g->pos[g->ply].turn == WHITE ? "0-1" : "1-0");
         str_cpy_c(reason, "adjudication");
@@ -428,13 +568,77 @@ void game_export_pgn(const Game *g, int verbosity, str_t *out)
     str_cat_c(str_cat(out, result), "\n\n");
 }
 
-void game_export_samples(const Game *g, str_t *out)
+// Binary sample header. Records follow, back to back; their count is derived from the file size.
+typedef struct {
+    char magic[8];  // "ccc-smp1"
+    uint64_t recordSize;  // sizeof(SampleRecord), to reject layout mismatches
+} SampleHeader;
+
+void game_sample_start(FILE *out, bool bin)
+{
+    if (bin && !ftell(out)) {
+        const SampleHeader h = {.magic = "ccc-smp1", .recordSize = sizeof(SampleRecord)};
+        DIE_IF(0, fwrite(&h, sizeof(h), 1, out) != 1);
+    }
+}
+
+static SampleRecord *sample_records(const Game *g)
+{
+    SampleRecord *records = vec_init_reserve(vec_size(g->samples), SampleRecord);
+
+    for (size_t i = 0; i < vec_size(g->samples); i++)
+        vec_push(records, ((SampleRecord){
+            .pos = g->samples[i].pos,
+            .score = (int32_t)g->samples[i].score,
+            .result = (int32_t)g->samples[i].result
+        }));
+
+    return records;
+}
+
+static void sample_csv(const Game *g, str_t *text)
 {
-    str_clear(out);
     scope(str_destroy) str_t fen = str_init();
 
     for (size_t i = 0; i < vec_size(g->samples); i++) {
         pos_get(&g->samples[i].pos, &fen, g->sfen);
-        str_cat_fmt(out, "%S,%i,%i\n", fen, g->samples[i].score, g->samples[i].result);
+        str_cat_fmt(text, "%S,%i,%i\n", fen, g->samples[i].score, g->samples[i].result);
+    }
+}
+
+void game_write_samples(const Game *g, FILE *out, bool bin)
+// Appends the game's samples to the (shared) sample file, in completion order (-join mode, where
+// leased indices are sparse). The whole game goes out in one stdio call, so workers contend on the
+// FILE lock once per game, not once per sample.
+{
+    if (bin) {
+        SampleRecord *records = sample_records(g);
+
+        if (vec_size(records))
+            DIE_IF(0, fwrite(records, sizeof(SampleRecord), vec_size(records), out)
+                != vec_size(records));
+
+        vec_destroy(records);
+    } else {
+        scope(str_destroy) str_t text = str_init();
+        sample_csv(g, &text);
+        fputs(text.buf, out);
+    }
+}
+
+void game_push_samples(const Game *g, SeqWriter *sw, size_t idx, bool bin)
+// Ordered flavour of game_write_samples(): hands the serialized samples to the sample writer, so
+// they land in game index order like the PGN. Pushed for every game, even a sample-less one, else
+// the writer would wait forever for this index.
+{
+    if (bin) {
+        SampleRecord *records = sample_records(g);
+        seq_writer_push(sw, idx, (const char *)records,
+            vec_size(records) * sizeof(SampleRecord));
+        vec_destroy(records);
+    } else {
+        scope(str_destroy) str_t text = str_init();
+        sample_csv(g, &text);
+        seq_writer_push(sw, idx, text.buf, text.len);
     }
 }
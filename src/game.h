@@ -16,6 +16,7 @@
 #include "position.h"
 #include "engine.h"
 #include "options.h"
+#include "seqwriter.h"
 #include "str.h"
 
 enum {
@@ -34,7 +35,10 @@ enum {
     STATE_THREEFOLD,  // draw by 3 position repetition
     STATE_FIFTY_MOVES,  // draw by 50 moves rule
     STATE_INSUFFICIENT_MATERIAL,  // draw due to insufficient material to deliver checkmate
-    STATE_DRAW_ADJUDICATION  // draw by adjudication
+    STATE_DRAW_ADJUDICATION,  // draw by adjudication
+
+    // Not a draw despite its position in the enum: the result is given by Game.tbResult
+    STATE_TB_ADJUDICATION  // adjudicated from the built-in endgame tables (-tb)
 };
 
 typedef struct {
@@ -43,24 +47,45 @@ typedef struct {
     int result;  // game result from pos.turn's pov
 } Sample;
 
+// Fixed-width record of a binary sample file (-sample with a '.bin' filename). Same idea as the
+// binary opening book: the raw Position plus score/result, so the training side reads records with
+// a memcpy instead of text encoding here and FEN parsing there.
+typedef struct {
+    Position pos;
+    int32_t score;  // score returned by the engine (in cp)
+    int32_t result;  // game result from pos.turn's pov
+} SampleRecord;
+
 typedef struct {
     str_t names[NB_COLOR];  // names of players, by color
     Position *pos;  // list of positions (including moves) since game start
     Info *info;  // remembered from parsing info lines (for PGN comments)
     Sample *samples;  // list of samples when generating training data
+    str_t posCmd;  // cached "position fen ... [moves ...]" command, extended incrementally
     int round, game, ply, state;
+    int posCmdPly;  // ply posCmd is valid for, -1 if stale (forces a rebuild)
+    int tbResult;  // for STATE_TB_ADJUDICATION: wdl from the side to move's pov (-1, 0, +1)
+    bool posCmdMoves;  // posCmd already contains the "moves" section
     bool sfen;  // use S-FEN for this game (ie. HAha instead of KQkq)
-    char pad[7];
+    char pad[6];
 } Game;
 
 Game game_init(int round, int game);
+void game_reset(Game *g, int round, int game);
 void game_destroy(Game *g);
 
 bool game_load_fen(Game *g, const char *fen, int *color);
+void game_load_pos(Game *g, const Position *pos, bool sfen, int *color);
 
-int game_play(Worker *w, Game *g, const Options *o, const Engine engines[2],
+int game_play(Worker *w, Game *g, const Options *o, Engine engines[2],
     const EngineOptions *eo[2], bool reverse);
 
 void game_decode_state(const Game *g, str_t *result, str_t *reason);
 void game_export_pgn(const Game *g, int verbosity, str_t *out);
-void game_export_samples(const Game *g, str_t *out);
+
+void game_sample_start(FILE *out, bool bin);  // writes the binary header, if the file is new
+void game_write_samples(const Game *g, FILE *out, bool bin);
+void game_push_samples(const Game *g, SeqWriter *sw, size_t idx, bool bin);
+
+void game_sample_dedup_init(int mb);
+void game_sample_dedup_destroy(void);
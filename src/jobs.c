@@ -13,9 +13,19 @@
  * not, see <http://www.gnu.org/licenses/>.
 */
 #include "jobs.h"
+#include "util.h"
 #include "vec.h"
 #include "workers.h"
 #include <stdio.h>
+#include <string.h>
+
+// Checkpoint file: header, followed by one outcome count record (WLD and pentanomial) per pair
+typedef struct {
+    char magic[8];  // "ccc-ckp2"
+    uint64_t jobs, pairs;  // tournament shape, to validate the checkpoint against the command line
+    uint64_t wtm;  // all jobs below wtm are complete, and covered by the counts
+    int64_t pgnSize, sampleSize;  // output file sizes at checkpoint time (-1 when not in use)
+} CheckpointHeader;
 
 static void job_queue_init_pair(int games, int e1, int e2, int pair, int *added, int round,
     Job **jobs)
@@ -41,47 +51,78 @@ JobQueue job_queue_init(int engines, int rounds, int games, bool gauntlet)
     jq.jobs = vec_init(Job);
     jq.results = vec_init(Result);
     jq.names = vec_init(str_t);
+    jq.played = vec_init(atomic_uchar);
 
     // Prepare engine names: blank for now, will be discovered at run time (concurrently)
     for (int i = 0; i < engines; i++)
         vec_push(jq.names, str_init());
 
+    // Jobs are laid out pair-major: all rounds of a pair are contiguous, so workers popping
+    // sequential indices keep the same engines loaded across pair boundaries as long as possible
+    // (one engine swap per pair, instead of one per pair per round). Game numbers within each
+    // round are unchanged — only the playing order differs — so PGN Round tags, opening pairing
+    // with -repeat, and results are as before.
     if (gauntlet) {
         // Gauntlet: N-1 pairs (0, e2) with 0 < e2
         for (int e2 = 1; e2 < engines; e2++) {
-            const Result r = {.ei = {0, e2}, .count = {0}, {0}};
+            const Result r = {.ei = {0, e2}};
             vec_push(jq.results, r);
         }
 
-        for (int r = 0; r < rounds; r++) {
-            int added = 0;  // number of games already added to the current round
-
-            for (int e2 = 1; e2 < engines; e2++)
+        for (int e2 = 1; e2 < engines; e2++)
+            for (int r = 0; r < rounds; r++) {
+                int added = (e2 - 1) * games;  // number of games before this pair, in this round
                 job_queue_init_pair(games, 0, e2, e2 - 1, &added, r, &jq.jobs);
-        }
+            }
     } else {
         // Round robin: N(N-1)/2 pairs (e1, e2) with e1 < e2
+        int pair = 0;  // enumerate pairs in order
+
         for (int e1 = 0; e1 < engines - 1; e1++)
             for (int e2 = e1 + 1; e2 < engines; e2++) {
-                const Result r = {.ei = {e1, e2}, .count = {0}, {0}};
-                vec_push(jq.results, r);
-            }
+                const Result res = {.ei = {e1, e2}};
+                vec_push(jq.results, res);
 
-        for (int r = 0; r < rounds; r++) {
-            int pair = 0;  // enumerate pairs in order
-            int added = 0;  // number of games already added to the current round
+                for (int r = 0; r < rounds; r++) {
+                    int added = pair * games;  // number of games before this pair, in this round
+                    job_queue_init_pair(games, e1, e2, pair, &added, r, &jq.jobs);
+                }
 
-            for (int e1 = 0; e1 < engines - 1; e1++)
-                for (int e2 = e1 + 1; e2 < engines; e2++)
-                    job_queue_init_pair(games, e1, e2, pair++, &added, r, &jq.jobs);
-        }
+                pair++;
+            }
     }
 
+    for (size_t i = 0; i < vec_size(jq.jobs); i++)
+        vec_push(jq.played, NB_RESULT);
+
     return jq;
 }
 
+// Jobs 2k and 2k+1 play the same opening with reversed colors (-repeat reads opening idx / 2), so
+// they form a game pair. Returns the pair mate of idx, or idx itself when it has none (odd job
+// count, or layouts where the neighbour is not a reversed game of the same engine pair).
+static size_t pair_mate(const JobQueue *jq, size_t idx)
+{
+    const size_t mate = idx ^ 1;
+
+    return mate < vec_size(jq->jobs) && jq->jobs[mate].pair == jq->jobs[idx].pair
+        && jq->jobs[mate].reverse != jq->jobs[idx].reverse ? mate : idx;
+}
+
+// Enable pentanomial bookkeeping: aggregate outcomes per game pair rather than per game. Call
+// before starting the workers, and only when pairs share openings (-repeat).
+void job_queue_pair_scoring(JobQueue *jq)
+{
+    jq->pairDone = vec_init_reserve((vec_size(jq->jobs) + 1) / 2, atomic_uchar);
+
+    for (size_t i = 0; i < (vec_size(jq->jobs) + 1) / 2; i++)
+        vec_push(jq->pairDone, 0);
+}
+
 void job_queue_destroy(JobQueue *jq)
 {
+    vec_destroy(jq->pairDone);
+    vec_destroy(jq->played);
     vec_destroy(jq->results);
     vec_destroy(jq->jobs);
     vec_destroy_rec(jq->names, str_destroy);
@@ -90,46 +131,167 @@ void job_queue_destroy(JobQueue *jq)
 
 bool job_queue_pop(JobQueue *jq, Job *j, size_t *idx, size_t *count)
 {
-    pthread_mutex_lock(&jq->mtx);
-    const bool ok = jq->idx < vec_size(jq->jobs);
+    // jobs[] is immutable, so claiming the next one is just an atomic increment. Note that idx can
+    // overshoot vec_size once the queue drains (or job_queue_stop fast-forwards it): harmless, as
+    // overshooting pops simply return false.
+    const size_t i = atomic_fetch_add(&jq->idx, 1);
 
-    if (ok) {
-        *j = jq->jobs[jq->idx];
-        *idx = jq->idx++;
-        *count = vec_size(jq->jobs);
-    }
+    if (i >= vec_size(jq->jobs))
+        return false;
 
-    pthread_mutex_unlock(&jq->mtx);
-    return ok;
+    *j = jq->jobs[i];
+    *idx = i;
+    *count = vec_size(jq->jobs);
+    return true;
 }
 
-// Add game outcome, and return updated totals
-void job_queue_add_result(JobQueue *jq, int pair, int outcome, int count[3])
+// Add game outcome, and return updated totals. penta[] (may be NULL) receives the pentanomial
+// totals, when pair scoring is enabled.
+void job_queue_add_result(JobQueue *jq, size_t idx, int pair, int outcome, int count[3],
+    int penta[5])
 {
-    pthread_mutex_lock(&jq->mtx);
-    jq->results[pair].count[outcome]++;
-    jq->completed++;
+    atomic_store(&jq->played[idx], (unsigned char)outcome);
+    atomic_fetch_add(&jq->results[pair].count[outcome], 1);
+
+    // Pentanomial bookkeeping: whichever game of the pair finishes second folds both outcomes
+    // into one of 5 buckets, indexed by e1's half points over the pair. The fetch-add on
+    // pairDone[] makes exactly one of the two finishers see 1, so a pair is never counted twice,
+    // and the mate's outcome (stored before its own fetch-add) is always visible to the counter.
+    if (jq->pairDone && pair_mate(jq, idx) != idx
+            && atomic_fetch_add(&jq->pairDone[idx / 2], 1) == 1) {
+        // RESULT_LOSS/DRAW/WIN = 0/1/2 is e1's half point count for one game
+        const int halfPoints = outcome + atomic_load(&jq->played[pair_mate(jq, idx)]);
+        atomic_fetch_add(&jq->results[pair].penta[halfPoints], 1);
+    }
+
+    atomic_fetch_add(&jq->completed, 1);
 
     for (size_t i = 0; i < 3; i++)
-        count[i] = jq->results[pair].count[i];
+        count[i] = atomic_load(&jq->results[pair].count[i]);
 
-    pthread_mutex_unlock(&jq->mtx);
+    if (penta)
+        for (size_t i = 0; i < 5; i++)
+            penta[i] = atomic_load(&jq->results[pair].penta[i]);
 }
 
 bool job_queue_done(JobQueue *jq)
 {
-    pthread_mutex_lock(&jq->mtx);
-    assert(jq->idx <= vec_size(jq->jobs));
-    const bool done = jq->idx == vec_size(jq->jobs);
-    pthread_mutex_unlock(&jq->mtx);
-    return done;
+    return atomic_load(&jq->idx) >= vec_size(jq->jobs);
 }
 
 void job_queue_stop(JobQueue *jq)
 {
-    pthread_mutex_lock(&jq->mtx);
-    jq->idx = vec_size(jq->jobs);
-    pthread_mutex_unlock(&jq->mtx);
+    atomic_store(&jq->idx, vec_size(jq->jobs));
+}
+
+// Save a checkpoint (main thread only). maxWtm caps the watermark at the last job the PGN writer
+// has flushed, so that pgnSize always covers exactly the jobs below the saved watermark.
+void job_queue_checkpoint_save(JobQueue *jq, const char *fileName, size_t maxWtm, int64_t pgnSize,
+    int64_t sampleSize)
+{
+    // Advance the watermark over completed jobs, accumulating their outcomes into results[].ckpt.
+    // Workers only ever flip played[] from NB_RESULT to a final value, so a stale read here just
+    // means the job gets picked up by the next checkpoint. With pair scoring, only whole pairs are
+    // committed: a resumed run replays any half-finished pair from scratch, so the pentanomial
+    // counts stay consistent with the watermark.
+    while (jq->wtm < maxWtm && jq->wtm < vec_size(jq->jobs)) {
+        const unsigned char outcome = atomic_load(&jq->played[jq->wtm]);
+
+        if (outcome == NB_RESULT)
+            break;
+
+        Result *r = &jq->results[jq->jobs[jq->wtm].pair];
+        const size_t mate = jq->pairDone ? pair_mate(jq, jq->wtm) : jq->wtm;
+
+        if (mate != jq->wtm) {
+            assert(mate == jq->wtm + 1);
+            const unsigned char mateOutcome = atomic_load(&jq->played[mate]);
+
+            if (mate >= maxWtm || mateOutcome == NB_RESULT)
+                break;
+
+            r->ckpt[mateOutcome]++;
+            r->pentaCkpt[outcome + mateOutcome]++;
+            jq->wtm++;
+        }
+
+        r->ckpt[outcome]++;
+        jq->wtm++;
+    }
+
+    // Write to a scratch file, then rename into place, so that a crash mid-write cannot corrupt an
+    // existing checkpoint
+    scope(str_destroy) str_t tmpName = str_init_from_c(fileName);
+    str_cat_c(&tmpName, ".tmp");
+
+    FILE *out = fopen(tmpName.buf, "wb");
+    DIE_IF(0, !out);
+
+    CheckpointHeader header = {
+        .jobs = vec_size(jq->jobs), .pairs = vec_size(jq->results),
+        .wtm = jq->wtm,
+        .pgnSize = pgnSize, .sampleSize = sampleSize
+    };
+    memcpy(header.magic, "ccc-ckp2", 8);
+    DIE_IF(0, fwrite(&header, sizeof(header), 1, out) < 1);
+
+    for (size_t i = 0; i < vec_size(jq->results); i++) {
+        uint64_t count[8] = {0};
+
+        for (size_t k = 0; k < 3; k++)
+            count[k] = (uint64_t)jq->results[i].ckpt[k];
+
+        for (size_t k = 0; k < 5; k++)
+            count[3 + k] = (uint64_t)jq->results[i].pentaCkpt[k];
+
+        DIE_IF(0, fwrite(count, sizeof(count), 1, out) < 1);
+    }
+
+    DIE_IF(0, fclose(out) == EOF);
+    DIE_IF(0, rename(tmpName.buf, fileName) < 0);
+}
+
+// Load a checkpoint, if one exists: skip completed jobs, and seed the result table. Returns true on
+// success, false when there is nothing to resume from. Call before starting the workers.
+bool job_queue_checkpoint_load(JobQueue *jq, const char *fileName, int64_t *pgnSize,
+    int64_t *sampleSize)
+{
+    FILE *in = fopen(fileName, "rb");
+
+    if (!in)
+        return false;  // first run: nothing to resume
+
+    CheckpointHeader header = {0};
+
+    if (fread(&header, sizeof(header), 1, in) < 1 || memcmp(header.magic, "ccc-ckp2", 8))
+        DIE("'%s' is not a checkpoint file\n", fileName);
+
+    if (header.jobs != vec_size(jq->jobs) || header.pairs != vec_size(jq->results))
+        DIE("checkpoint '%s' does not match this tournament\n", fileName);
+
+    jq->wtm = header.wtm;
+    atomic_store(&jq->idx, jq->wtm);  // jobs below the watermark are done: don't pop them again
+    atomic_store(&jq->completed, jq->wtm);
+
+    for (size_t i = 0; i < vec_size(jq->results); i++) {
+        uint64_t count[8] = {0};
+        DIE_IF(0, fread(count, sizeof(count), 1, in) < 1);
+
+        for (size_t k = 0; k < 3; k++) {
+            jq->results[i].ckpt[k] = (int)count[k];
+            atomic_store(&jq->results[i].count[k], (int)count[k]);
+        }
+
+        for (size_t k = 0; k < 5; k++) {
+            jq->results[i].pentaCkpt[k] = (int)count[3 + k];
+            atomic_store(&jq->results[i].penta[k], (int)count[3 + k]);
+        }
+    }
+
+    fclose(in);
+    *pgnSize = header.pgnSize;
+    *sampleSize = header.sampleSize;
+    return true;
 }
 
 void job_queue_set_name(JobQueue *jq, int ei, const char *name)
@@ -142,28 +304,33 @@ void job_queue_set_name(JobQueue *jq, int ei, const char *name)
     pthread_mutex_unlock(&jq->mtx);
 }
 
-void job_queue_print_results(JobQueue *jq, size_t frequency)
+void job_queue_print_table(JobQueue *jq)
 {
+    // The mutex only serializes printing (and guards names[]); results are read with atomic loads
     pthread_mutex_lock(&jq->mtx);
+    scope(str_destroy) str_t out = str_init_from_c("Tournament update:\n");
 
-    if (jq->completed && jq->completed % frequency == 0) {
-        scope(str_destroy) str_t out = str_init_from_c("Tournament update:\n");
-
-        for (size_t i = 0; i < vec_size(jq->results); i++) {
-            const Result r = jq->results[i];
-            const int n = r.count[RESULT_WIN] + r.count[RESULT_LOSS] + r.count[RESULT_DRAW];
+    for (size_t i = 0; i < vec_size(jq->results); i++) {
+        const Result r = jq->results[i];
+        const int n = r.count[RESULT_WIN] + r.count[RESULT_LOSS] + r.count[RESULT_DRAW];
 
-            if (n) {
-                char score[8] = "";
-                sprintf(score, "%.3f", (r.count[RESULT_WIN] + 0.5 * r.count[RESULT_DRAW]) / n);
-                str_cat_fmt(&out, "%S vs %S: %i - %i - %i  [%s] %i\n", jq->names[r.ei[0]],
-                    jq->names[r.ei[1]], r.count[RESULT_WIN], r.count[RESULT_LOSS],
-                    r.count[RESULT_DRAW], score, n);
-            }
+        if (n) {
+            char score[8] = "";
+            sprintf(score, "%.3f", (r.count[RESULT_WIN] + 0.5 * r.count[RESULT_DRAW]) / n);
+            str_cat_fmt(&out, "%S vs %S: %i - %i - %i  [%s] %i\n", jq->names[r.ei[0]],
+                jq->names[r.ei[1]], r.count[RESULT_WIN], r.count[RESULT_LOSS],
+                r.count[RESULT_DRAW], score, n);
         }
-
-        fputs(out.buf, stdout);
     }
 
+    fputs(out.buf, stdout);
     pthread_mutex_unlock(&jq->mtx);
 }
+
+void job_queue_print_results(JobQueue *jq, size_t frequency)
+{
+    const size_t completed = atomic_load(&jq->completed);
+
+    if (completed && completed % frequency == 0)
+        job_queue_print_table(jq);
+}
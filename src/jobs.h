@@ -13,15 +13,23 @@
  * not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <inttypes.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include "str.h"
 
 // Result for each pair (e1, e2); e1 < e2. Stores count of game outcomes from e1's point of view.
+// Counters are atomic, so workers record results without any shared lock. penta[] counts completed
+// game pairs by the number of half points e1 scored over the pair (0..4), used by the pentanomial
+// SPRT; it stays zero unless pair scoring is enabled. ckpt[]/pentaCkpt[] hold the subset of the
+// counters covered by the checkpoint watermark (main thread only).
 typedef struct {
     int ei[2];
-    int count[3];
-    char pad[4];
+    atomic_int count[3];
+    atomic_int penta[5];
+    int ckpt[3];
+    int pentaCkpt[5];
 } Result;
 
 // Job: instruction to play a single game
@@ -32,23 +40,37 @@ typedef struct {
     char pad[3];
 } Job;
 
-// Job Queue: consumed by workers to play tournament (thread safe)
+// Job Queue: consumed by workers to play tournament (thread safe). jobs[] is fully materialized at
+// init and never mutated, so popping is a single atomic fetch-add on idx — no mutex on the hot
+// path. The mutex only guards names[] (written once, at engine discovery) and printing.
 typedef struct {
     pthread_mutex_t mtx;
     Job *jobs;
-    size_t idx;  // next job index
-    size_t completed;  // number of jobs completed
+    atomic_size_t idx;  // next job index
+    atomic_size_t completed;  // number of jobs completed
     str_t *names;
     Result *results;
+    atomic_uchar *played;  // outcome per job (NB_RESULT until the job completes)
+    atomic_uchar *pairDone;  // games finished per game pair; NULL unless pair scoring is enabled
+    size_t wtm;  // checkpoint watermark: all jobs below wtm are complete (main thread only)
 } JobQueue;
 
 JobQueue job_queue_init(int engines, int rounds, int games, bool gauntlet);
 void job_queue_destroy(JobQueue *jq);
 
+void job_queue_pair_scoring(JobQueue *jq);
+
 bool job_queue_pop(JobQueue *jq, Job *j, size_t *idx, size_t *count);
-void job_queue_add_result(JobQueue *jq, int pair, int outcome, int count[3]);
+void job_queue_add_result(JobQueue *jq, size_t idx, int pair, int outcome, int count[3],
+    int penta[5]);
 bool job_queue_done(JobQueue *jq);
 void job_queue_stop(JobQueue *jq);
 
+void job_queue_checkpoint_save(JobQueue *jq, const char *fileName, size_t maxWtm, int64_t pgnSize,
+    int64_t sampleSize);
+bool job_queue_checkpoint_load(JobQueue *jq, const char *fileName, int64_t *pgnSize,
+    int64_t *sampleSize);
+
 void job_queue_set_name(JobQueue *jq, int ei, const char *name);
+void job_queue_print_table(JobQueue *jq);
 void job_queue_print_results(JobQueue *jq, size_t frequency);
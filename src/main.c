@@ -12,15 +12,24 @@
  * You should have received a copy of the GNU General Public License along with this program. If
  * not, see <http://www.gnu.org/licenses/>.
 */
+#ifdef __linux__
+    #define _GNU_SOURCE
+    #include <sched.h>
+#endif
+
 #include <pthread.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "engine.h"
 #include "game.h"
 #include "jobs.h"
+#include "net.h"
 #include "openings.h"
 #include "options.h"
+#include "pool.h"
 #include "seqwriter.h"
 #include "sprt.h"
+#include "tb.h"
 #include "util.h"
 #include "vec.h"
 #include "workers.h"
@@ -28,18 +37,37 @@
 static Options options;
 static EngineOptions *eo;
 static Openings openings;
-static SeqWriter pgnSeqWriter;
-FILE *sampleFile;
+static SeqWriter pgnSeqWriter, sampleSeqWriter;
+FILE *sampleFile;  // completion order sample output, -join mode only (leased indices are sparse)
 static JobQueue jq;
+static EnginePool pool;
+static Remote remote;  // connection to the master, in -join mode
+static atomic_int busy;  // number of worker threads still running (used in -join mode)
 
 static void main_destroy(void)
 {
+    workers_log_stop();
+    workers_watchdog_stop();
+
+    if (vec_size(Workers))
+        engine_pool_destroy(&pool, &Workers[0]);
+
     vec_destroy_rec(Workers, worker_destroy);
 
-    if (options.sample.len)
+    if (remote.in)
+        net_client_destroy(&remote);
+
+    if (sampleFile)
         fclose(sampleFile);
 
-    if (options.pgn.len)
+    if (sampleSeqWriter.out)
+        seq_writer_destroy(&sampleSeqWriter);
+
+    game_sample_dedup_destroy();
+    engine_stats_destroy();
+    tb_destroy();
+
+    if (pgnSeqWriter.out)
         seq_writer_destroy(&pgnSeqWriter);
 
     openings_destroy(&openings, 0);
@@ -56,14 +84,78 @@ static void main_init(int argc, const char **argv)
     options = options_init();
     options_parse(argc, argv, &options, &eo);
 
+    if (options.stats)
+        engine_stats_enable();
+
+    if (options.tb)
+        tb_init();
+
+    // Book conversion mode: convert and exit, no tournament
+    if (options.makebook.len) {
+        openings_convert(options.openings.buf, options.makebook.buf);
+        exit(EXIT_SUCCESS);
+    }
+
     jq = job_queue_init(vec_size(eo), options.rounds, options.games, options.gauntlet);
+
+    // With -repeat, games come in reversed-color pairs sharing an opening, and the SPRT can run on
+    // the lower variance pentanomial model over pairs, which stops markedly earlier
+    if (options.sprt && options.repeat)
+        job_queue_pair_scoring(&jq);
+
     openings = openings_init(options.openings.buf, options.random, options.srand, 0);
 
+    // Allow each worker to park a spare pair of engines, so a worker bouncing between 2 pairs never
+    // pays a respawn
+    pool = engine_pool_init(2 * (size_t)options.concurrency);
+
     if (options.pgn.len)
         pgnSeqWriter = seq_writer_init(options.pgn.buf, "ae");
 
-    if (options.sample.len)
-        DIE_IF(0, !(sampleFile = fopen(options.sample.buf, "ae")));
+    if (options.sample.len) {
+        if (options.join.len) {
+            // Our leased indices are sparse, so ordered writing cannot apply: samples append in
+            // completion order (-join rejects -resume, so there is no watermark to respect)
+            DIE_IF(0, !(sampleFile = fopen(options.sample.buf, "ae")));
+            game_sample_start(sampleFile, options.sampleBin);
+        } else {
+            // Samples go through an ordered writer, like the PGN, so the checkpoint watermark
+            // covers exactly the samples below it. Appending in completion order would leak
+            // samples from games above the watermark into the recorded file size, and -resume
+            // would then replay those games, duplicating their samples.
+            sampleSeqWriter = seq_writer_init(options.sample.buf, "ae");
+            game_sample_start(sampleSeqWriter.out, options.sampleBin);
+            fflush(sampleSeqWriter.out);
+            sampleSeqWriter.size = ftell(sampleSeqWriter.out);  // count the header as flushed
+        }
+
+        if (options.sampleDedup)
+            game_sample_dedup_init(options.sampleDedup);
+    }
+
+    // Resume: skip already-played jobs, seed the result table, and truncate the output files back
+    // to the state recorded by the checkpoint (a crash may have appended beyond it)
+    if (options.resume.len) {
+        int64_t pgnSize = -1, sampleSize = -1;
+
+        if (job_queue_checkpoint_load(&jq, options.resume.buf, &pgnSize, &sampleSize)) {
+            if (options.pgn.len && pgnSize >= 0)
+                seq_writer_seek(&pgnSeqWriter, jq.wtm, pgnSize);
+
+            if (options.sample.len && sampleSize >= 0)
+                seq_writer_seek(&sampleSeqWriter, jq.wtm, sampleSize);
+
+            printf("Resuming at game %zu of %zu\n", jq.wtm + 1, vec_size(jq.jobs));
+        }
+    }
+
+    // Distributed mode: serve leases to remote workers, or join a master
+    if (options.masterPort)
+        net_master_start(options.masterPort, &jq, options.pgn.len ? &pgnSeqWriter : NULL,
+            options.sample.len ? &sampleSeqWriter : NULL);
+
+    if (options.join.len)
+        remote = net_client_init(options.join.buf, vec_size(jq.jobs), 2 * options.concurrency);
 
     // Prepare Workers[]
     Workers = vec_init(Worker);
@@ -74,8 +166,87 @@ static void main_init(int argc, const char **argv)
         if (options.log)
             str_cat_fmt(&logName, "c-chess-cli.%i.log", i + 1);
 
-        vec_push(Workers, worker_init(i, logName.buf));
+        vec_push(Workers, worker_init(i, logName.buf, options.affinity));
+    }
+
+    if (options.log)
+        workers_log_start();
+
+    workers_watchdog_start();
+}
+
+// Checkpoint the tournament state (main thread only). The watermark is capped at the last game
+// both ordered writers have flushed, so the recorded file sizes cover exactly the games below the
+// watermark.
+static void main_checkpoint(void)
+{
+    size_t maxWtm = (size_t)-1;
+    int64_t pgnSize = -1, sampleSize = -1;
+
+    if (options.pgn.len)
+        maxWtm = seq_writer_tell(&pgnSeqWriter, &pgnSize);
+
+    if (options.sample.len)
+        maxWtm = min(maxWtm, seq_writer_tell(&sampleSeqWriter, &sampleSize));
+
+    job_queue_checkpoint_save(&jq, options.resume.buf, maxWtm, pgnSize, sampleSize);
+}
+
+// Aggregated progress report (main thread, -report mode): one line per interval, instead of
+// several worker lines per game. rate is in games per second, measured over the last interval.
+static void main_report(size_t completed, double rate)
+{
+    scope(str_destroy) str_t line = str_init();
+    char fmt[32];
+
+    sprintf(fmt, "%.1f", rate);
+
+    if (options.reportJson)
+        str_cat_fmt(&line, "{\"games\":%U,\"total\":%U,\"rate\":%s", (uintmax_t)completed,
+            (uintmax_t)vec_size(jq.jobs), fmt);
+    else
+        str_cat_fmt(&line, "Progress: %U/%U games, %s games/s", (uintmax_t)completed,
+            (uintmax_t)vec_size(jq.jobs), fmt);
+
+    if (vec_size(eo) == 2) {
+        // Single pair: aggregated W-L-D score and, with -sprt, the current LLR
+        int wldCount[3] = {0};
+
+        for (int outcome = 0; outcome < 3; outcome++)
+            wldCount[outcome] = atomic_load(&jq.results[0].count[outcome]);
+
+        if (options.reportJson)
+            str_cat_fmt(&line, ",\"w\":%i,\"l\":%i,\"d\":%i", wldCount[RESULT_WIN],
+                wldCount[RESULT_LOSS], wldCount[RESULT_DRAW]);
+        else
+            str_cat_fmt(&line, ", W-L-D: %i-%i-%i", wldCount[RESULT_WIN], wldCount[RESULT_LOSS],
+                wldCount[RESULT_DRAW]);
+
+        if (options.sprt) {
+            // Match the model the stopping rule uses: pentanomial when pair scoring is on
+            double llr = 0;
+
+            if (jq.pairDone) {
+                int pentaCount[5] = {0};
+
+                for (int k = 0; k < 5; k++)
+                    pentaCount[k] = atomic_load(&jq.results[0].penta[k]);
+
+                llr = sprt_penta_llr(pentaCount, options.sprtParam.elo0, options.sprtParam.elo1);
+            } else
+                llr = sprt_llr(wldCount, options.sprtParam.elo0, options.sprtParam.elo1);
+
+            sprintf(fmt, "%.3f", llr);
+            str_cat_fmt(&line, options.reportJson ? ",\"llr\":%s" : ", LLR: %s", fmt);
+        }
     }
+
+    str_cat_c(&line, options.reportJson ? "}\n" : "\n");
+    fputs(line.buf, stdout);
+    fflush(stdout);
+
+    if (vec_size(eo) > 2 && !options.reportJson)
+        job_queue_print_table(&jq);
 }
 
 static void *thread_start(void *arg)
@@ -83,84 +254,137 @@ static void *thread_start(void *arg)
     Worker *w = arg;
     Engine engines[2] = {0};
 
+#ifdef __linux__
+    // With -affinity, keep the worker thread on its engines' cpu pair, so the I/O wakeups stay on
+    // the same cache (and NUMA node) as the engines
+    if (w->cpus[0] >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t)w->cpus[0], &set);
+        CPU_SET((size_t)w->cpus[1], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
     scope(str_destroy) str_t fen = str_init();
+    Game game = game_init(0, 0);  // reused from job to job: buffers keep their high-water capacity
     Job job = {0};
     int ei[2] = {-1, -1};  // eo[ei[0]] plays eo[ei[1]]: initialize with invalid values to start
     size_t idx = 0, count = 0;  // game idx and count (shared across workers)
 
-    while (job_queue_pop(&jq, &job, &idx, &count)) {
-        // Engine stop/start, as needed
+    while (options.join.len
+            ? net_client_pop(&remote, &idx)
+            : job_queue_pop(&jq, &job, &idx, &count)) {
+        if (options.join.len) {
+            // Leased indices refer to the same jobs[] layout on both sides (validated at connect)
+            job = jq.jobs[idx];
+            count = vec_size(jq.jobs);
+        }
+
+        // Engine swap, as needed: park the old engine in the pool rather than killing it, and
+        // prefer a parked process over a fresh spawn
         for (int i = 0; i < 2; i++)
             if (job.ei[i] != ei[i]) {
                 if (engines[i].pid)
-                    engine_destroy(w, &engines[i]);
+                    engine_pool_put(&pool, w, ei[i], &engines[i]);
 
                 ei[i] = job.ei[i];
-                engines[i] = engine_init(w, eo[ei[i]].cmd.buf, eo[ei[i]].name.buf, eo[ei[i]].options);
+                engines[i] = engine_pool_get(&pool, w, ei[i], eo[ei[i]].cmd.buf,
+                    eo[ei[i]].name.buf, eo[ei[i]].options);
+                engine_pin(w, &engines[i], w->cpus[i]);
                 job_queue_set_name(&jq, ei[i], engines[i].name.buf);
             }
 
         // Choose opening position
-        openings_next(&openings, &fen, options.repeat ? idx / 2 : idx, w->id);
-
-        // Play 1 game
-        Game game = game_init(job.round, job.game);
+        game_reset(&game, job.round, job.game);
         int color = WHITE;
 
-        if (!game_load_fen(&game, fen.buf, &color))
-            DIE("[%d] illegal FEN '%s'\n", w->id, fen.buf);
+        if (openings.bin) {
+            BookEntry entry = {0};
+            openings_next_pos(&openings, &entry, options.repeat ? idx / 2 : idx);
+            game_load_pos(&game, &entry.pos, entry.sfen, &color);
+        } else {
+            openings_next(&openings, &fen, options.repeat ? idx / 2 : idx, w->id);
+
+            if (!game_load_fen(&game, fen.buf, &color))
+                DIE("[%d] illegal FEN '%s'\n", w->id, fen.buf);
+        }
 
         const int whiteIdx = color ^ job.reverse;
 
-        printf("[%d] Started game %zu of %zu (%s vs %s)\n", w->id, idx + 1, count,
-            engines[whiteIdx].name.buf, engines[opposite(whiteIdx)].name.buf);
+        if (!options.report)
+            printf("[%d] Started game %zu of %zu (%s vs %s)\n", w->id, idx + 1, count,
+                engines[whiteIdx].name.buf, engines[opposite(whiteIdx)].name.buf);
 
         const EngineOptions *eoPair[2] = {&eo[ei[0]], &eo[ei[1]]};
         const int wld = game_play(w, &game, &options, engines, eoPair, job.reverse);
 
-        // Write to PGN file
-        if (options.pgn.len) {
-            scope(str_destroy) str_t pgnText = str_init();
-            game_export_pgn(&game, options.pgnVerbosity, &pgnText);
-            seq_writer_push(&pgnSeqWriter, idx, pgnText);
+        // Write to stdout a one line summary of the game
+        if (!options.report) {
+            scope(str_destroy) str_t result = str_init(), reason = str_init();
+            game_decode_state(&game, &result, &reason);
+
+            printf("[%d] Finished game %zu (%s vs %s): %s {%s}\n", w->id, idx + 1,
+                engines[whiteIdx].name.buf, engines[opposite(whiteIdx)].name.buf, result.buf,
+                reason.buf);
         }
 
-        // Write to Sample file
-        if (options.sample.len) {
-            scope(str_destroy) str_t sampleText = str_init();
-            game_export_samples(&game, &sampleText);
-            fputs(sampleText.buf, sampleFile);
+        // Pair update. Record the result before pushing the PGN below, so that the checkpoint
+        // watermark (capped at what the PGN writer has flushed) only ever covers recorded games.
+        int wldCount[3] = {0}, pentaCount[5] = {0};
+        job_queue_add_result(&jq, idx, job.pair, wld, wldCount,
+            jq.pairDone ? pentaCount : NULL);
+
+        if (!options.report) {
+            const int n = wldCount[RESULT_WIN] + wldCount[RESULT_LOSS] + wldCount[RESULT_DRAW];
+            printf("Score of %s vs %s: %d - %d - %d  [%.3f] %d\n", engines[0].name.buf,
+                engines[1].name.buf, wldCount[RESULT_WIN], wldCount[RESULT_LOSS],
+                wldCount[RESULT_DRAW],
+                (wldCount[RESULT_WIN] + 0.5 * wldCount[RESULT_DRAW]) / n, n);
         }
 
-        // Write to stdout a one line summary of the game
-        scope(str_destroy) str_t result = str_init(), reason = str_init();
-        game_decode_state(&game, &result, &reason);
+        // Write to PGN file, or stream the result (with PGN text) to the master, who owns the
+        // ordered file
+        if (options.join.len) {
+            scope(str_destroy) str_t pgnText = str_init();
 
-        printf("[%d] Finished game %zu (%s vs %s): %s {%s}\n", w->id, idx + 1,
-            engines[whiteIdx].name.buf, engines[opposite(whiteIdx)].name.buf, result.buf, reason.buf);
+            if (options.pgn.len)
+                game_export_pgn(&game, options.pgnVerbosity, &pgnText);
 
-        // Pair update
-        int wldCount[3] = {0};
-        job_queue_add_result(&jq, job.pair, wld, wldCount);
-        const int n = wldCount[RESULT_WIN] + wldCount[RESULT_LOSS] + wldCount[RESULT_DRAW];
-        printf("Score of %s vs %s: %d - %d - %d  [%.3f] %d\n", engines[0].name.buf,
-            engines[1].name.buf, wldCount[RESULT_WIN], wldCount[RESULT_LOSS], wldCount[RESULT_DRAW],
-            (wldCount[RESULT_WIN] + 0.5 * wldCount[RESULT_DRAW]) / n, n);
+            net_client_result(&remote, idx, job.pair, wld, pgnText);
+        } else if (options.pgn.len) {
+            scope(str_destroy) str_t pgnText = str_init();
+            game_export_pgn(&game, options.pgnVerbosity, &pgnText);
+            seq_writer_push(&pgnSeqWriter, idx, pgnText.buf, pgnText.len);
+        }
+
+        // Write to Sample file: after the result, like the PGN, so the checkpoint watermark only
+        // ever covers recorded games
+        if (options.sample.len) {
+            if (options.join.len)
+                game_write_samples(&game, sampleFile, options.sampleBin);
+            else
+                game_push_samples(&game, &sampleSeqWriter, idx, options.sampleBin);
+        }
 
         // SPRT update
-        if (options.sprt && sprt_done(wldCount, &options.sprtParam))
+        if (options.sprt && sprt_done(wldCount, jq.pairDone ? pentaCount : NULL,
+                &options.sprtParam, !options.report))
             job_queue_stop(&jq);
 
         // Tournament update
-        if (vec_size(eo) > 2)
+        if (vec_size(eo) > 2 && !options.report)
             job_queue_print_results(&jq, (size_t)options.games);
-
-        game_destroy(&game);
     }
 
+    game_destroy(&game);
+
+    // Shutdown: no point parking our engines, the run is over
     for (int i = 0; i < 2; i++)
-        engine_destroy(w, &engines[i]);
+        if (engines[i].pid)
+            engine_destroy(w, &engines[i]);
 
+    atomic_fetch_sub(&busy, 1);
     return NULL;
 }
 
@@ -171,28 +395,68 @@ int main(int argc, const char **argv)
     // Start threads[]
     pthread_t threads[options.concurrency];
 
+    // Workers allocate everything sizeable on the heap, so a small stack suffices. The default (8MB
+    // on Linux) adds up to real memory at -concurrency in the hundreds.
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 512 * 1024);
+
+    atomic_store(&busy, options.concurrency);
+
     for (int i = 0; i < options.concurrency; i++)
-        pthread_create(&threads[i], NULL, thread_start, &Workers[i]);
+        pthread_create(&threads[i], &attr, thread_start, &Workers[i]);
+
+    pthread_attr_destroy(&attr);
+
+    // Main thread loop: wait for the tournament to finish, checkpointing at regular intervals.
+    // Engine deadlines are enforced by the watchdog thread, which sleeps until the earliest
+    // registered deadline instead of polling every worker.
+    int64_t lastCheckpoint = system_msec(), lastReport = system_msec();
+    size_t reported = 0;
 
-    // Main thread loop: check deadline overdue at regular intervals
     do {
         system_sleep(100);
 
-        // We want some tolerance on small delays here. Given a choice, it's best to wait for the
-        // worker thread to notice an overdue deadline, which it will handled nicely by counting the
-        // game as lost for the offending engine, and continue. Enforcing deadlines from the master
-        // thread is the last resort solution, because it is an unrecovrable error. At this point we
-        // are likely to face a completely unresponsive engine, where any attempt at I/O will block
-        // the master thread, on top of the already blocked worker. Hence, we must DIE().
-        for (int i = 0; i < options.concurrency; i++)
-            if (deadline_overdue(&Workers[i]) > 1000)
-                DIE("[%d] engine %s is unresponsive\n", Workers[i].id,
-                    Workers[i].deadline.engineName.buf);
-    } while (!job_queue_done(&jq));
+        if (options.resume.len && system_msec() - lastCheckpoint >= 10000) {
+            main_checkpoint();
+            lastCheckpoint = system_msec();
+        }
+
+        if (options.report && system_msec() - lastReport >= options.report * 1000) {
+            const size_t completed = atomic_load(&jq.completed);
+            main_report(completed,
+                (double)(completed - reported) * 1000.0 / (double)(system_msec() - lastReport));
+            reported = completed;
+            lastReport = system_msec();
+        }
+
+        // In -join mode the local queue index never moves (jobs are leased from the master), so
+        // run until the worker threads have exhausted their leases
+    } while (options.join.len ? atomic_load(&busy) > 0 : !job_queue_done(&jq));
 
     // Join threads[]
     for (int i = 0; i < options.concurrency; i++)
         pthread_join(threads[i], NULL);
 
+    // Master: our own threads are done, but remote workers may still hold leased jobs
+    if (options.masterPort) {
+        net_master_wait();
+        net_master_stop();
+    }
+
+    // Record the final state, so that rerunning a finished tournament doesn't replay anything
+    if (options.resume.len)
+        main_checkpoint();
+
+    if (options.stats)
+        engine_stats_print();
+
+    // Final aggregated report, covering runs shorter than the report interval
+    if (options.report) {
+        const size_t completed = atomic_load(&jq.completed);
+        main_report(completed,
+            (double)(completed - reported) * 1000.0 / (double)max(system_msec() - lastReport, 1));
+    }
+
     return 0;
 }
@@ -0,0 +1,304 @@
+/*
+ * c-chess-cli, a command line interface for UCI chess engines. Copyright 2020 lucasart.
+ *
+ * c-chess-cli is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * c-chess-cli is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <http://www.gnu.org/licenses/>.
+*/
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "net.h"
+#include "util.h"
+#include "vec.h"
+#include "workers.h"
+
+// Master state: one listener thread, plus one (detached) thread per connected worker. All of them
+// feed the same JobQueue and SeqWriter, which are already thread safe.
+static struct {
+    JobQueue *jq;
+    SeqWriter *pgnWriter;  // NULL when -pgn is not in use
+    SeqWriter *sampleWriter;  // NULL when -sample is not in use
+    pthread_t listener;
+    atomic_size_t leased;  // jobs granted to remote workers
+    atomic_size_t returned;  // results received back from remote workers
+    int fd;  // listening socket
+    char pad[4];
+} Master;
+
+static void *master_serve(void *arg)
+{
+    const int fd = (int)(intptr_t)arg;
+    FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+    DIE_IF(0, !in || !out);
+
+    scope(str_destroy) str_t line = str_init();
+
+    while (str_getline(&line, in)) {
+        const char *tail = NULL;
+
+        if ((tail = str_prefix(line.buf, "hello "))) {
+            // Validate the tournament shape: both sides must run the same -games/-rounds/-engines
+            const bool ok = strtoull(tail, NULL, 10) == vec_size(Master.jq->jobs);
+            fputs(ok ? "ok\n" : "bad\n", out);
+            fflush(out);
+
+            if (!ok)
+                break;
+        } else if ((tail = str_prefix(line.buf, "lease "))) {
+            // Claim a batch of jobs for this worker: same atomic increment as a local pop, just by
+            // more than 1. Overshoot past the end is harmless (see job_queue_pop).
+            const size_t n = strtoull(tail, NULL, 10), size = vec_size(Master.jq->jobs);
+            const size_t start = atomic_fetch_add(&Master.jq->idx, n);
+
+            if (start >= size || !n)
+                fputs("done\n", out);
+            else {
+                const size_t count = n < size - start ? n : size - start;
+                fprintf(out, "jobs %zu %zu\n", start, count);
+                atomic_fetch_add(&Master.leased, count);
+            }
+
+            fflush(out);
+        } else if ((tail = str_prefix(line.buf, "result "))) {
+            size_t idx = 0, bytes = 0;
+            int pair = 0, outcome = 0;
+
+            // The size cap matters: 'bytes' comes off the wire, and a hostile worker must not be
+            // able to command an arbitrarily large allocation (real games are a few KB of PGN)
+            if (sscanf(tail, "%zu %d %d %zu", &idx, &pair, &outcome, &bytes) != 4
+                    || idx >= vec_size(Master.jq->jobs)
+                    || (size_t)pair >= vec_size(Master.jq->results)
+                    || outcome < 0 || outcome >= NB_RESULT
+                    || bytes > ((size_t)8 << 20))
+                break;
+
+            char *pgn = malloc(bytes + 1);
+
+            if (!pgn || (bytes && fread(pgn, 1, bytes, in) != bytes)) {
+                free(pgn);
+                break;
+            }
+
+            pgn[bytes] = '\0';
+
+            int count[3] = {0};
+            job_queue_add_result(Master.jq, idx, pair, outcome, count, NULL);
+
+            // Push even when empty, else the writer would wait forever for this game
+            if (Master.pgnWriter)
+                seq_writer_push(Master.pgnWriter, idx, pgn, bytes);
+
+            // Remote samples stay on the worker's machine: an empty entry keeps the local sample
+            // stream contiguous
+            if (Master.sampleWriter)
+                seq_writer_push(Master.sampleWriter, idx, NULL, 0);
+
+            free(pgn);
+            atomic_fetch_add(&Master.returned, 1);
+        } else
+            break;  // protocol violation: drop the connection
+    }
+
+    fclose(in);
+    fclose(out);
+    return NULL;
+}
+
+static void *master_listen(void *dummy)
+{
+    (void)dummy;
+
+    while (true) {
+        const int fd = accept(Master.fd, NULL, NULL);
+
+        if (fd < 0)
+            break;  // listening socket closed: we're shutting down
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, master_serve, (void *)(intptr_t)fd);
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+void net_master_start(int port, JobQueue *jq, SeqWriter *pgnWriter, SeqWriter *sampleWriter)
+{
+    signal(SIGPIPE, SIG_IGN);  // a worker vanishing must not kill the tournament
+
+    Master.jq = jq;
+    Master.pgnWriter = pgnWriter;
+    Master.sampleWriter = sampleWriter;
+
+    DIE_IF(0, (Master.fd = socket(AF_INET, SOCK_STREAM, 0)) < 0);
+
+    const int yes = 1;
+    setsockopt(Master.fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+
+    DIE_IF(0, bind(Master.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0);
+    DIE_IF(0, listen(Master.fd, 16) < 0);
+
+    pthread_create(&Master.listener, NULL, master_listen, NULL);
+}
+
+// Wait for remote workers to return the results of the jobs they hold. Give up after 60s without
+// progress: a worker died, and its leased games are lost.
+void net_master_wait(void)
+{
+    size_t last = atomic_load(&Master.returned);
+    int64_t lastProgress = system_msec();
+
+    while (atomic_load(&Master.returned) < atomic_load(&Master.leased)) {
+        const size_t returned = atomic_load(&Master.returned);
+
+        if (returned != last) {
+            last = returned;
+            lastProgress = system_msec();
+        } else if (system_msec() - lastProgress > 60000) {
+            printf("Giving up on %zu leased game(s): remote worker(s) unreachable\n",
+                atomic_load(&Master.leased) - returned);
+
+            // The ordered writers only flush contiguous runs: an abandoned game would stall them
+            // at its index forever, and everything buffered above it would be lost at shutdown.
+            // Our own workers are done by now, so any unplayed job is abandoned: push empty
+            // entries for them (a late result would duplicate the index, which the flusher drops)
+            for (size_t i = 0; i < vec_size(Master.jq->jobs); i++)
+                if (atomic_load(&Master.jq->played[i]) == NB_RESULT) {
+                    if (Master.pgnWriter)
+                        seq_writer_push(Master.pgnWriter, i, NULL, 0);
+
+                    if (Master.sampleWriter)
+                        seq_writer_push(Master.sampleWriter, i, NULL, 0);
+                }
+
+            break;
+        }
+
+        system_sleep(100);
+    }
+}
+
+void net_master_stop(void)
+{
+    // shutdown() wakes up the blocked accept(), so the listener can exit cleanly
+    shutdown(Master.fd, SHUT_RDWR);
+    close(Master.fd);
+    pthread_join(Master.listener, NULL);
+}
+
+Remote net_client_init(const char *address, size_t jobs, int batch)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    // address is of the form HOST:PORT
+    const char *colon = strrchr(address, ':');
+
+    if (!colon || !colon[1])
+        DIE("invalid master address '%s'\n", address);
+
+    scope(str_destroy) str_t host = str_init();
+    str_ncpy(&host, str_ref(address), (size_t)(colon - address));
+
+    struct addrinfo hints = {0}, *res = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    DIE_IF(0, getaddrinfo(host.buf, colon + 1, &hints, &res) != 0);
+
+    int fd = -1;
+    DIE_IF(0, (fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0);
+    DIE_IF(0, connect(fd, res->ai_addr, res->ai_addrlen) < 0);
+    freeaddrinfo(res);
+
+    Remote r = {0};
+    pthread_mutex_init(&r.mtx, NULL);
+    r.batch = batch > 1 ? batch : 1;
+    DIE_IF(0, !(r.in = fdopen(fd, "r")) || !(r.out = fdopen(dup(fd), "w")));
+
+    // Handshake: agree on the tournament shape
+    fprintf(r.out, "hello %zu\n", jobs);
+    fflush(r.out);
+
+    scope(str_destroy) str_t line = str_init();
+
+    if (!str_getline(&line, r.in) || strcmp(line.buf, "ok"))
+        DIE("master at '%s' rejected us (tournament shape mismatch?)\n", address);
+
+    return r;
+}
+
+void net_client_destroy(Remote *r)
+{
+    fclose(r->in);
+    fclose(r->out);
+    pthread_mutex_destroy(&r->mtx);
+}
+
+// Remote flavour of job_queue_pop(): take the next index from the current lease, or get a fresh
+// lease from the master. Returns false when the master has no more jobs for us.
+bool net_client_pop(Remote *r, size_t *idx)
+{
+    pthread_mutex_lock(&r->mtx);
+
+    if (r->lo >= r->hi) {
+        fprintf(r->out, "lease %d\n", r->batch);
+        fflush(r->out);
+
+        scope(str_destroy) str_t line = str_init();
+
+        // EOF here is a normal end: the master may exit before answering our next lease request,
+        // which just means there is nothing left to play. A mid-game disconnect still fails, when
+        // the result write hits the dead socket.
+        if (!str_getline(&line, r->in)) {
+            pthread_mutex_unlock(&r->mtx);
+            return false;
+        }
+
+        const char *tail = str_prefix(line.buf, "jobs ");
+        size_t start = 0, count = 0;
+
+        if (!tail || sscanf(tail, "%zu %zu", &start, &count) != 2 || !count) {
+            pthread_mutex_unlock(&r->mtx);
+            return false;  // "done": tournament over (or stopped)
+        }
+
+        r->lo = start;
+        r->hi = start + count;
+    }
+
+    *idx = r->lo++;
+    pthread_mutex_unlock(&r->mtx);
+    return true;
+}
+
+void net_client_result(Remote *r, size_t idx, int pair, int outcome, str_t pgn)
+{
+    pthread_mutex_lock(&r->mtx);
+    fprintf(r->out, "result %zu %d %d %zu\n", idx, pair, outcome, pgn.len);
+
+    if (pgn.len)
+        fwrite(pgn.buf, 1, pgn.len, r->out);
+
+    // A dead socket here is fatal: the game was played, and its result cannot be delivered
+    // (SIGPIPE is ignored, so the failure surfaces as a write error)
+    if (fflush(r->out) != 0)
+        DIE("lost connection to the master\n");
+
+    pthread_mutex_unlock(&r->mtx);
+}
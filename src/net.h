@@ -0,0 +1,47 @@
+/*
+ * c-chess-cli, a command line interface for UCI chess engines. Copyright 2020 lucasart.
+ *
+ * c-chess-cli is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * c-chess-cli is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <pthread.h>
+#include <stdio.h>
+#include "jobs.h"
+#include "seqwriter.h"
+#include "str.h"
+
+// Distributed mode: the master owns the job queue, the result table and the (ordered) PGN file.
+// Joined instances lease batches of job indices over TCP, play them with their local engines, and
+// stream back results and PGN text. The protocol is line based:
+//
+//   worker: "hello JOBS"                        master: "ok" (or "bad" on shape mismatch)
+//   worker: "lease N"                           master: "jobs START COUNT" or "done"
+//   worker: "result IDX PAIR OUTCOME BYTES\n" followed by BYTES bytes of PGN text (no reply)
+
+// Client side: one connection to the master, shared by all worker threads
+typedef struct {
+    pthread_mutex_t mtx;
+    FILE *in, *out;  // master connection (reading and writing ends)
+    size_t lo, hi;  // current lease: job indices in [lo, hi) are ours to play
+    int batch;  // how many jobs to lease at a time
+    char pad[4];
+} Remote;
+
+void net_master_start(int port, JobQueue *jq, SeqWriter *pgnWriter, SeqWriter *sampleWriter);
+void net_master_wait(void);
+void net_master_stop(void);
+
+Remote net_client_init(const char *address, size_t jobs, int batch);
+void net_client_destroy(Remote *r);
+
+bool net_client_pop(Remote *r, size_t *idx);
+void net_client_result(Remote *r, size_t idx, int pair, int outcome, str_t pgn);
@@ -13,27 +13,141 @@
  * not, see <http://www.gnu.org/licenses/>.
 */
 #include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "openings.h"
 #include "util.h"
 #include "vec.h"
 
+// Sidecar index file: caches the line offsets of a book, so that subsequent runs skip the full
+// scan of the book (which takes minutes on 50M+ line EPD files). Offsets are stored in book order;
+// the shuffle for '-openings order=random' is recomputed in memory (an O(n) pass, trivially cheap
+// next to the scan), which keeps the cache valid regardless of command line flags.
+typedef struct {
+    char magic[8];  // "ccc-idx1"
+    uint64_t size, mtime;  // of the book file, for validation
+    uint64_t count;  // number of offsets that follow
+} IndexHeader;
+
+_Static_assert(sizeof(size_t) == sizeof(uint64_t), "index entries are stored as uint64_t");
+
+// Binary book header. Records follow, back to back; their count is derived from the file size.
+typedef struct {
+    char magic[8];  // "ccc-bok1"
+    uint64_t recordSize;  // sizeof(BookEntry), to reject layout mismatches
+} BookHeader;
+
+static bool openings_load_index(Openings *o, const char *idxName, const struct stat *st)
+{
+    FILE *f = fopen(idxName, "re");
+
+    if (!f)
+        return false;
+
+    struct stat idxSt = {0};
+
+    IndexHeader h = {0};
+    bool ok = fstat(fileno(f), &idxSt) == 0
+        && fread(&h, sizeof(h), 1, f) == 1
+        && !memcmp(h.magic, "ccc-idx1", 8)
+        && h.size == (uint64_t)st->st_size
+        && h.mtime == (uint64_t)st->st_mtime
+        // Don't trust the on-disk count for the allocation below: it must fit in the sidecar's own
+        // remaining bytes (a corrupt header could otherwise command an arbitrarily large malloc)
+        && h.count <= ((uint64_t)idxSt.st_size - sizeof(h)) / sizeof(size_t);
+
+    if (ok) {
+        vec_destroy(o->index);
+        o->index = vec_init_reserve(h.count, size_t);
+        ok = fread(o->index, sizeof(size_t), h.count, f) == h.count;
+
+        if (ok)
+            vec_ptr(o->index)->size = h.count;
+    }
+
+    fclose(f);
+    return ok;
+}
+
+static void openings_save_index(const Openings *o, const char *idxName, const struct stat *st)
+{
+    // Best-effort: the book directory may be read-only, in which case we just rescan next time
+    FILE *f = fopen(idxName, "we");
+
+    if (!f)
+        return;
+
+    IndexHeader h = {.magic = "ccc-idx1", .size = (uint64_t)st->st_size,
+        .mtime = (uint64_t)st->st_mtime, .count = vec_size(o->index)};
+
+    // A torn write (concurrent runs, crash) is caught by the count check on load
+    if (fwrite(&h, sizeof(h), 1, f) == 1)
+        fwrite(o->index, sizeof(size_t), vec_size(o->index), f);
+
+    fclose(f);
+}
+
 Openings openings_init(const char *fileName, bool random, uint64_t srand, int threadId)
 {
     Openings o = {0};
     o.index = vec_init(size_t);
 
-    if (*fileName)
-        DIE_IF(threadId, !(o.file = fopen(fileName, "re")));
+    if (*fileName) {
+        // Map the book read-only: from here on, fetching an opening is a pointer computation plus
+        // a copy of one line, with no locking, no fseek, and no read syscalls.
+        const int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+        DIE_IF(threadId, fd < 0);
+
+        struct stat st = {0};
+        DIE_IF(threadId, fstat(fd, &st) < 0);
+        o.size = (size_t)st.st_size;
+
+        if (o.size) {
+            o.map = mmap(NULL, o.size, PROT_READ, MAP_PRIVATE, fd, 0);
+            DIE_IF(threadId, o.map == MAP_FAILED);
+
+            o.bin = o.size >= sizeof(BookHeader) && !memcmp(o.map, "ccc-bok1", 8);
+
+            if (o.bin) {
+                // Binary book: the index is pure arithmetic, no scan and no sidecar needed
+                const BookHeader *h = (const BookHeader *)o.map;
+
+                if (h->recordSize != sizeof(BookEntry))
+                    DIE("[%d] '%s' was made with an incompatible c-chess-cli version\n", threadId,
+                        fileName);
+
+                const size_t count = (o.size - sizeof(BookHeader)) / sizeof(BookEntry);
 
-    if (o.file) {
-        // Fill o.index[] to record file offsets for each lines
-        scope(str_destroy) str_t line = str_init();
+                if (!count)
+                    DIE("[%d] '%s' contains no positions\n", threadId, fileName);
 
-        do {
-            vec_push(o.index, ftell(o.file));
-        } while (str_getline(&line, o.file));
+                for (size_t i = 0; i < count; i++)
+                    vec_push(o.index, sizeof(BookHeader) + i * sizeof(BookEntry));
+            } else {
+                scope(str_destroy) str_t idxName = str_init();
+                str_cpy_fmt(&idxName, "%s.idx", fileName);
 
-        vec_pop(o.index);  // EOF offset must be removed
+                if (!openings_load_index(&o, idxName.buf, &st)) {
+                    // No valid sidecar index: scan the book for line offsets, and cache the result
+                    vec_push(o.index, (size_t)0);
+
+                    for (const char *lf = o.map;
+                        (lf = memchr(lf, '\n', o.size - (size_t)(lf - o.map))); )
+                        vec_push(o.index, (size_t)(++lf - o.map));
+
+                    // EOF offset must be removed (book ending with a newline)
+                    if (o.index[vec_size(o.index) - 1] == o.size)
+                        vec_pop(o.index);
+
+                    openings_save_index(&o, idxName.buf, &st);
+                }
+            }
+        }
+
+        DIE_IF(threadId, close(fd) < 0);
 
         if (random) {
             // Shuffle o.index[], which will be read sequentially from the beginning. This allows
@@ -49,33 +163,86 @@ Openings openings_init(const char *fileName, bool random, uint64_t srand, int th
         }
     }
 
-    pthread_mutex_init(&o.mtx, NULL);
     return o;
 }
 
 void openings_destroy(Openings *o, int threadId)
 {
-    if (o->file)
-        DIE_IF(threadId, fclose(o->file) < 0);
+    if (o->map)
+        DIE_IF(threadId, munmap(o->map, o->size) < 0);
 
-    pthread_mutex_destroy(&o->mtx);
     vec_destroy(o->index);
 }
 
-void openings_next(Openings *o, str_t *fen, size_t idx, int threadId)
+void openings_next(const Openings *o, str_t *fen, size_t idx, int threadId)
 {
-    if (!o->file) {
+    (void)threadId;
+    assert(!o->bin);
+
+    if (!o->map) {
         str_cpy_c(fen, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
         return;
     }
 
-    // Read 'fen' from file
-    scope(str_destroy) str_t line = str_init();
+    // Slice the line out of the mapping
+    const size_t start = o->index[idx % vec_size(o->index)];
+    const char *begin = o->map + start;
+    const char *lf = memchr(begin, '\n', o->size - start);
+    size_t len = lf ? (size_t)(lf - begin) : o->size - start;
+
+    // FEN is the part of the line before the first ';' (EPD operations may follow)
+    const char *semi = memchr(begin, ';', len);
+
+    if (semi)
+        len = (size_t)(semi - begin);
+
+    str_ncpy(fen, (str_t){.buf = (char *)begin, .len = len, .alloc = len + 1}, len);
+}
+
+void openings_next_pos(const Openings *o, BookEntry *entry, size_t idx)
+{
+    assert(o->bin);
+    memcpy(entry, o->map + o->index[idx % vec_size(o->index)], sizeof(*entry));
+}
+
+void openings_convert(const char *in, const char *out)
+{
+    if (!*in)
+        DIE("-makebook requires an input book (-openings file=FILE)\n");
+
+    FILE *fin = fopen(in, "re");
+    DIE_IF(0, !fin);
+    FILE *fout = fopen(out, "we");
+    DIE_IF(0, !fout);
+
+    const BookHeader h = {.magic = "ccc-bok1", .recordSize = sizeof(BookEntry)};
+    DIE_IF(0, fwrite(&h, sizeof(h), 1, fout) != 1);
+
+    scope(str_destroy) str_t line = str_init(), fen = str_init();
+    size_t count = 0;
+
+    while (str_getline(&line, fin)) {
+        // FEN is the part of the line before the first ';' (EPD operations may follow)
+        if (!str_tok(line.buf, &fen, ";"))
+            continue;  // skip blank lines
+
+        BookEntry entry = {0};
+
+        if (!pos_set(&entry.pos, fen.buf, false, &entry.sfen))
+            DIE("-makebook: illegal FEN '%s' (line %zu)\n", fen.buf, count + 1);
+
+        DIE_IF(0, fwrite(&entry, sizeof(entry), 1, fout) != 1);
+        count++;
+    }
+
+    DIE_IF(0, fclose(fout) < 0);
+    DIE_IF(0, fclose(fin) < 0);
 
-    pthread_mutex_lock(&o->mtx);
-    DIE_IF(threadId, fseek(o->file, o->index[idx % vec_size(o->index)], SEEK_SET) < 0);
-    DIE_IF(threadId, !str_getline(&line, o->file));
-    pthread_mutex_unlock(&o->mtx);
+    // Refuse to leave a header-only book behind: openings_init() rejects empty books
+    if (!count) {
+        unlink(out);
+        DIE("-makebook: no positions found in '%s'\n", in);
+    }
 
-    str_tok(line.buf, fen, ";");
+    printf("Converted %zu positions from '%s' to '%s'\n", count, in, out);
 }
@@ -14,18 +14,38 @@
 */
 #pragma once
 #include <inttypes.h>
-#include <pthread.h>
 #include <stdbool.h>
-#include <stdio.h>
+#include <stddef.h>
+#include "position.h"
 #include "str.h"
 
+// Record of a binary book (see openings_convert). Games start from it with a memcpy instead of FEN
+// parsing, and it is several-fold smaller than FEN text for typical EPD books.
 typedef struct {
-    pthread_mutex_t mtx;
-    FILE *file;
-    long *index;  // vector of file offsets
+    Position pos;
+    bool sfen;  // position was written in S-FEN castling notation (HAha)
+    char pad[7];
+} BookEntry;
+
+// Opening book, memory mapped at init. After openings_init() everything is read-only, so workers
+// fetch openings concurrently without any locking. Both EPD text books and binary books (made with
+// -makebook, auto-detected by magic) are supported.
+typedef struct {
+    char *map;  // mmap'd book file (NULL if no book)
+    size_t size;  // size of the mapping
+    size_t *index;  // vector of line (or record) offsets into map
+    bool bin;  // binary book (BookEntry records) rather than EPD text
+    char pad[7];
 } Openings;
 
 Openings openings_init(const char *fileName, bool random, uint64_t srand, int threadId);
 void openings_destroy(Openings *openings, int threadId);
 
-void openings_next(Openings *o, str_t *fen, size_t idx, int threadId);
+// Next opening from a text book, as a FEN string
+void openings_next(const Openings *o, str_t *fen, size_t idx, int threadId);
+
+// Next opening from a binary book
+void openings_next_pos(const Openings *o, BookEntry *entry, size_t idx);
+
+// Converts an EPD text book to the packed binary format
+void openings_convert(const char *in, const char *out);
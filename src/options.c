@@ -36,11 +36,39 @@ static void options_parse_sample(const char *s, Options *o)
     if ((tail = str_tok(tail, &token, ",")))
         o->sampleResolvePv = !strcmp(token.buf, "y");
 
-    // Parse filename (default sample.csv if omitted)
+    // Parse filename (default sample.csv if omitted). A '.bin' extension selects the packed binary
+    // format (SampleRecord), which skips FEN encoding and is several-fold smaller than CSV.
     if ((tail = str_tok(tail, &token, ",")))
         str_cpy(&o->sample, token);
     else
         str_cpy_c(&o->sample, "sample.csv");
+
+    o->sampleBin = o->sample.len >= 4 && !strcmp(&o->sample.buf[o->sample.len - 4], ".bin");
+
+    // Parse dedup cache size in MiB (default 0 = no deduplication)
+    if ((tail = str_tok(tail, &token, ","))) {
+        o->sampleDedup = atoi(token.buf);
+
+        if (o->sampleDedup < 0)
+            DIE("Sample dedup cache size '%s' must be >= 0\n", token.buf);
+    }
+}
+
+// Parse -report 'seconds[,json]': replace the per-game console output by an aggregated update
+// every given number of seconds, as human readable text, or as a JSON line per update
+static void options_parse_report(const char *s, Options *o)
+{
+    scope(str_destroy) str_t token = str_init();
+    const char *tail = str_tok(s, &token, ",");
+    assert(tail);
+
+    o->report = atoi(token.buf);
+
+    if (o->report <= 0)
+        DIE("Report interval '%s' must be > 0\n", token.buf);
+
+    if ((tail = str_tok(tail, &token, ",")))
+        o->reportJson = !strcmp(token.buf, "json");
 }
 
 // Parse time control. Expects 'mtg/time+inc' or 'time+inc'. Note that time and inc are provided by
@@ -65,8 +93,8 @@ static void options_parse_tc(const char *s, EngineOptions *eo)
         // left = time
         time = atof(left.buf);
 
-    eo->time = (int64_t)(time * 1000);
-    eo->increment = (int64_t)(increment * 1000);
+    eo->time = (int64_t)(time * 1000000000);
+    eo->increment = (int64_t)(increment * 1000000000);
 }
 
 static int options_parse_eo(int argc, const char **argv, int i, EngineOptions *eo)
@@ -85,7 +113,7 @@ static int options_parse_eo(int argc, const char **argv, int i, EngineOptions *e
         else if ((tail = str_prefix(argv[i], "nodes=")))
             eo->nodes = atoll(tail);
         else if ((tail = str_prefix(argv[i], "movetime=")))
-            eo->movetime = (int64_t)(atof(tail) * 1000);
+            eo->movetime = (int64_t)(atof(tail) * 1000000000);
         else if ((tail = str_prefix(argv[i], "tc=")))
             options_parse_tc(tail, eo);
         else
@@ -179,6 +207,9 @@ Options options_init(void)
     o.openings = str_init();
     o.pgn = str_init();
     o.sample = str_init();
+    o.makebook = str_init();
+    o.resume = str_init();
+    o.join = str_init();
 
     // non-zero default values
     o.concurrency = 1;
@@ -201,6 +232,14 @@ void options_parse(int argc, const char **argv, Options *o, EngineOptions **eo)
             o->gauntlet = true;
         else if (!strcmp(argv[i], "-log"))
             o->log = true;
+        else if (!strcmp(argv[i], "-pipeline"))
+            o->pipeline = true;
+        else if (!strcmp(argv[i], "-affinity"))
+            o->affinity = true;
+        else if (!strcmp(argv[i], "-stats"))
+            o->stats = true;
+        else if (!strcmp(argv[i], "-tb"))
+            o->tb = true;
         else if (!strcmp(argv[i], "-concurrency"))
             o->concurrency = atoi(argv[++i]);
         else if (!strcmp(argv[i], "-each")) {
@@ -229,6 +268,16 @@ void options_parse(int argc, const char **argv, Options *o, EngineOptions **eo)
             i = options_parse_sprt(argc, argv, i + 1, o);
         else if (!strcmp(argv[i], "-sample"))
             options_parse_sample(argv[++i], o);
+        else if (!strcmp(argv[i], "-makebook"))
+            str_cpy_c(&o->makebook, argv[++i]);
+        else if (!strcmp(argv[i], "-resume"))
+            str_cpy_c(&o->resume, argv[++i]);
+        else if (!strcmp(argv[i], "-master"))
+            o->masterPort = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-join"))
+            str_cpy_c(&o->join, argv[++i]);
+        else if (!strcmp(argv[i], "-report"))
+            options_parse_report(argv[++i], o);
         else
             DIE("Unknown option '%s'\n", argv[i]);
     }
@@ -264,14 +313,29 @@ void options_parse(int argc, const char **argv, Options *o, EngineOptions **eo)
         }
     }
 
-    if (vec_size(*eo) < 2)
+    if (vec_size(*eo) < 2 && !o->makebook.len)
         DIE("at least 2 engines are needed\n");
 
     if (vec_size(*eo) > 2 && o->sprt)
         DIE("only 2 engines for SPRT\n");
+
+    if (o->join.len && o->masterPort)
+        DIE("-join and -master are mutually exclusive\n");
+
+    if (o->join.len && o->sprt)
+        DIE("SPRT is decided by the master, not by joined workers\n");
+
+    if (o->join.len && o->resume.len)
+        DIE("-resume belongs on the master, not on joined workers\n");
+
+    if (o->resume.len && o->pgn.len >= 4 && !strcmp(&o->pgn.buf[o->pgn.len - 4], ".zst"))
+        DIE("-resume cannot truncate compressed PGN output (-pgn *.zst)\n");
+
+    if (o->resume.len && o->sample.len >= 4 && !strcmp(&o->sample.buf[o->sample.len - 4], ".zst"))
+        DIE("-resume cannot truncate compressed sample output (-sample *.zst)\n");
 }
 
 void options_destroy(Options *o)
 {
-    str_destroy_n(&o->openings, &o->pgn, &o->sample);
+    str_destroy_n(&o->openings, &o->pgn, &o->sample, &o->makebook, &o->resume, &o->join);
 }
@@ -19,21 +19,22 @@
 #include "str.h"
 
 typedef struct {
-    str_t openings, pgn, sample;
+    str_t openings, pgn, sample, makebook, resume, join;
     SPRTParam sprtParam;
     uint64_t srand;
     double sampleFrequency;
     int concurrency, games, rounds;
     int resignCount, resignScore;
     int drawCount, drawScore;
-    int pgnVerbosity;
-    bool log, random, repeat, sprt, gauntlet, sampleResolvePv;
-    char pad[2];
+    int pgnVerbosity, masterPort, sampleDedup, report;
+    bool log, random, repeat, sprt, gauntlet, sampleResolvePv, sampleBin, pipeline, affinity,
+        reportJson, stats, tb;
 } Options;
 
 typedef struct {
     str_t cmd, name, *options;
-    int64_t time, increment, movetime, nodes;
+    int64_t time, increment, movetime;  // in nsec; rounded down to msec at the UCI boundary
+    int64_t nodes;
     int depth, movestogo;
 } EngineOptions;
 
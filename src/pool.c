@@ -0,0 +1,81 @@
+/*
+ * c-chess-cli, a command line interface for UCI chess engines. Copyright 2020 lucasart.
+ *
+ * c-chess-cli is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * c-chess-cli is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <http://www.gnu.org/licenses/>.
+*/
+#include "pool.h"
+#include "vec.h"
+
+EnginePool engine_pool_init(size_t cap)
+{
+    EnginePool p = {0};
+    p.parked = vec_init(PoolEngine);
+    p.cap = cap;
+    pthread_mutex_init(&p.mtx, NULL);
+    return p;
+}
+
+void engine_pool_destroy(EnginePool *pool, Worker *w)
+{
+    for (size_t i = 0; i < vec_size(pool->parked); i++)
+        engine_destroy(w, &pool->parked[i].e);
+
+    vec_destroy(pool->parked);
+    pthread_mutex_destroy(&pool->mtx);
+}
+
+Engine engine_pool_get(EnginePool *pool, Worker *w, int ei, const char *cmd, const char *name,
+    const str_t *options)
+{
+    pthread_mutex_lock(&pool->mtx);
+
+    for (size_t i = 0; i < vec_size(pool->parked); i++)
+        if (pool->parked[i].ei == ei) {
+            const Engine e = pool->parked[i].e;
+            pool->parked[i] = vec_pop(pool->parked);  // swap-remove (order does not matter)
+            pthread_mutex_unlock(&pool->mtx);
+            return e;
+        }
+
+    pthread_mutex_unlock(&pool->mtx);
+
+    // No parked engine for this eo index: spawn one (outside the lock, as the uci..uciok handshake
+    // can take seconds for engines loading big networks)
+    return engine_init(w, cmd, name, options);
+}
+
+void engine_pool_put(EnginePool *pool, Worker *w, int ei, Engine *e)
+{
+    pthread_mutex_lock(&pool->mtx);
+
+    const PoolEngine pe = {.e = *e, .ei = ei, .lastUsed = ++pool->tick};
+    vec_push(pool->parked, pe);
+    *e = (Engine){0};
+
+    // Over capacity: evict the least recently used engine
+    if (vec_size(pool->parked) > pool->cap) {
+        size_t lru = 0;
+
+        for (size_t i = 1; i < vec_size(pool->parked); i++)
+            if (pool->parked[i].lastUsed < pool->parked[lru].lastUsed)
+                lru = i;
+
+        Engine victim = pool->parked[lru].e;
+        pool->parked[lru] = vec_pop(pool->parked);
+        pthread_mutex_unlock(&pool->mtx);
+
+        engine_destroy(w, &victim);
+        return;
+    }
+
+    pthread_mutex_unlock(&pool->mtx);
+}
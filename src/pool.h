@@ -0,0 +1,46 @@
+/*
+ * c-chess-cli, a command line interface for UCI chess engines. Copyright 2020 lucasart.
+ *
+ * c-chess-cli is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * c-chess-cli is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <pthread.h>
+#include "engine.h"
+#include "workers.h"
+
+// Idle engine process, parked in the pool until a worker needs that engine again
+typedef struct {
+    Engine e;
+    uint64_t lastUsed;  // tick of the last checkout (for LRU eviction)
+    int ei;  // index into the EngineOptions vec this process was spawned from
+    char pad[4];
+} PoolEngine;
+
+// Shared pool of engine processes, keyed by EngineOptions index. Keeping idle engines alive across
+// pair changes saves the uci..uciok handshake (and NNUE network load) on every restart.
+typedef struct {
+    pthread_mutex_t mtx;
+    PoolEngine *parked;  // vec of idle engines
+    uint64_t tick;  // checkout counter, drives LRU
+    size_t cap;  // max number of parked engines (LRU eviction beyond that)
+} EnginePool;
+
+EnginePool engine_pool_init(size_t cap);
+void engine_pool_destroy(EnginePool *pool, Worker *w);
+
+// Returns a parked engine for eo index 'ei' if one is available, otherwise spawns a new process
+// with engine_init()
+Engine engine_pool_get(EnginePool *pool, Worker *w, int ei, const char *cmd, const char *name,
+    const str_t *options);
+
+// Parks an idle engine, evicting the least recently used one if the pool is over capacity
+void engine_pool_put(EnginePool *pool, Worker *w, int ei, Engine *e);
@@ -12,79 +12,232 @@
  * You should have received a copy of the GNU General Public License along with this program. If
  * not, see <http://www.gnu.org/licenses/>.
 */
+#include <assert.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "seqwriter.h"
+#include "str.h"
+#include "util.h"
 #include "vec.h"
 
-static SeqStr seq_str_init(size_t idx, str_t str)
+static SeqStr seq_str_init(size_t idx, const char *bytes, size_t len)
+// Plain byte copy, not a str_t: sample records are binary and may contain NUL bytes
 {
-    return (SeqStr){
-        .idx = idx,
-        .str = str_init_from(str)
-    };
+    SeqStr ss = {.idx = idx, .len = len, .bytes = malloc(max(len, (size_t)1))};
+    DIE_IF(0, !ss.bytes);
+
+    if (len)
+        memcpy(ss.bytes, bytes, len);
+
+    return ss;
 }
 
 static void seq_str_destroy(SeqStr *ss)
 {
-    str_destroy(&ss->str);
+    free(ss->bytes);
+    *ss = (SeqStr){0};
+}
+
+// Min-heap on idx, stored in sw->buf (lock must be held)
+
+static void seq_heap_push(SeqWriter *sw, SeqStr entry)
+{
+    vec_push(sw->buf, entry);
+    size_t i = vec_size(sw->buf) - 1;
+
+    while (i && sw->buf[(i - 1) / 2].idx > sw->buf[i].idx) {
+        swap(sw->buf[(i - 1) / 2], sw->buf[i]);
+        i = (i - 1) / 2;
+    }
+}
+
+static SeqStr seq_heap_pop(SeqWriter *sw)
+{
+    const SeqStr top = sw->buf[0];
+    sw->buf[0] = sw->buf[vec_size(sw->buf) - 1];
+    vec_ptr(sw->buf)->size--;
+
+    size_t i = 0;
+
+    while (true) {
+        size_t smallest = i;
+        const size_t left = 2 * i + 1, right = 2 * i + 2;
+
+        if (left < vec_size(sw->buf) && sw->buf[left].idx < sw->buf[smallest].idx)
+            smallest = left;
+
+        if (right < vec_size(sw->buf) && sw->buf[right].idx < sw->buf[smallest].idx)
+            smallest = right;
+
+        if (smallest == i)
+            break;
+
+        swap(sw->buf[i], sw->buf[smallest]);
+        i = smallest;
+    }
+
+    return top;
+}
+
+static void *seq_writer_thread(void *arg)
+// Flusher thread: drains contiguous runs from the heap and writes them out. The file I/O happens
+// with the lock released, so a slow disk never backs up into seq_writer_push().
+{
+    SeqWriter *sw = arg;
+    SeqStr *run = vec_init(SeqStr);
+
+    pthread_mutex_lock(&sw->mtx);
+
+    while (true) {
+        // Drop stale entries (idx already flushed): a game the master gave up on can still get a
+        // late result, after its empty placeholder went out
+        while (vec_size(sw->buf) && sw->buf[0].idx < sw->idxNext) {
+            SeqStr stale = seq_heap_pop(sw);
+            seq_str_destroy(&stale);
+        }
+
+        if (vec_size(sw->buf) && sw->buf[0].idx == sw->idxNext + vec_size(run)) {
+            // Pop the longest contiguous run, then write it without the lock
+            do {
+                vec_push(run, seq_heap_pop(sw));
+            } while (vec_size(sw->buf) && sw->buf[0].idx == sw->idxNext + vec_size(run));
+
+            pthread_mutex_unlock(&sw->mtx);
+
+            int64_t bytes = 0;
+
+            for (size_t i = 0; i < vec_size(run); i++) {
+                if (run[i].len)
+                    DIE_IF(0, fwrite(run[i].bytes, 1, run[i].len, sw->out) != run[i].len);
+
+                bytes += (int64_t)run[i].len;
+                seq_str_destroy(&run[i]);
+            }
+
+            fflush(sw->out);
+
+            pthread_mutex_lock(&sw->mtx);
+
+            // Only now account for the run: seq_writer_tell() must never report games whose bytes
+            // are not on disk yet
+            sw->idxNext += vec_size(run);
+            sw->size += bytes;
+            vec_clear(run);
+        } else if (sw->stop)
+            break;
+        else
+            pthread_cond_wait(&sw->cond, &sw->mtx);
+    }
+
+    pthread_mutex_unlock(&sw->mtx);
+    vec_destroy(run);
+    return NULL;
 }
 
 SeqWriter seq_writer_init(const char *fileName, const char *mode)
 {
     SeqWriter sw = {0};
-    sw.out = fopen(fileName, mode);
+    const size_t len = strlen(fileName);
+    sw.zip = len >= 4 && !strcmp(&fileName[len - 4], ".zst");
+
+    if (sw.zip) {
+        // Compressed output: pipe the ordered stream through an external zstd process before it
+        // hits disk. PGN text compresses roughly 10x, and the compression runs in its own process,
+        // off the worker threads (the flusher only pays a pipe write). Appending works, because
+        // concatenated zstd frames form a valid stream.
+        // Probe for zstd now: a missing binary would otherwise only surface at pclose(), after
+        // the whole run has streamed into a dead pipe
+        if (system("command -v zstd > /dev/null 2>&1") != 0)
+            DIE("zstd not found in PATH, required for '%s'\n", fileName);
+
+        scope(str_destroy) str_t cmd = str_init();
+        str_cat_c(&cmd, "exec zstd -q >> '");
+
+        // Single-quote the file name for the shell, escaping embedded quotes (' -> '\''), so an
+        // unusual path cannot break out of the command
+        for (const char *c = fileName; *c; c++) {
+            if (*c == '\'')
+                str_cat_c(&cmd, "'\\''");
+            else
+                str_push(&cmd, *c);
+        }
+
+        str_push(&cmd, '\'');
+        DIE_IF(0, !(sw.out = popen(cmd.buf, "w")));
+    } else {
+        sw.out = fopen(fileName, mode);
+        fseek(sw.out, 0, SEEK_END);
+        sw.size = ftell(sw.out);
+    }
+
     sw.buf = vec_init(SeqStr);
     pthread_mutex_init(&sw.mtx, NULL);
+    pthread_cond_init(&sw.cond, NULL);
     return sw;
 }
 
-void seq_writer_destroy(SeqWriter *sw)
+// Start the flusher thread, lazily on first push. Kept out of seq_writer_init(), because the
+// SeqWriter is returned by value there: the thread must only capture its final resting address.
+static void seq_writer_start(SeqWriter *sw)
 {
-    pthread_mutex_destroy(&sw->mtx);
-    vec_destroy_rec(sw->buf, seq_str_destroy);
-    fclose(sw->out);
+    if (!sw->started) {
+        pthread_create(&sw->thread, NULL, seq_writer_thread, sw);
+        sw->started = true;
+    }
 }
 
-void seq_writer_push(SeqWriter *sw, size_t idx, str_t str)
+void seq_writer_destroy(SeqWriter *sw)
 {
-    pthread_mutex_lock(&sw->mtx);
+    if (sw->started) {
+        pthread_mutex_lock(&sw->mtx);
+        sw->stop = true;  // the flusher drains what it can, then exits
+        pthread_cond_signal(&sw->cond);
+        pthread_mutex_unlock(&sw->mtx);
+        pthread_join(sw->thread, NULL);
+    }
 
-    // Append to sw->buf[n]
-    const size_t n = vec_size(sw->buf);
-    vec_push(sw->buf, seq_str_init(idx, str));
+    pthread_cond_destroy(&sw->cond);
+    pthread_mutex_destroy(&sw->mtx);
+    vec_destroy_rec(sw->buf, seq_str_destroy);
 
-    // insert in correct position
-    for (size_t i = 0; i < n; i++)
-        if (sw->buf[i].idx > idx) {
-            SeqStr tmp = sw->buf[n];
-            memmove(&sw->buf[i + 1], &sw->buf[i], (n - i) * sizeof(SeqStr));
-            sw->buf[i] = tmp;
-            break;
-        }
+    if (sw->zip) {
+        if (pclose(sw->out) != 0)
+            DIE("zstd exited abnormally, compressed PGN output may be incomplete\n");
+    } else
+        fclose(sw->out);
+}
 
-    // Calculate i such that buf[0..i-1] is the longest sequential chunk
-    size_t i = 0;
-    for (; i < vec_size(sw->buf); i++)
-        if (sw->buf[i].idx != sw->idxNext + i) {
-            assert(sw->buf[i].idx > sw->idxNext + i);
-            break;
-        }
+// Resume support (call before starting the workers): consider jobs below idxNext already written,
+// and truncate the file back to size, dropping anything appended after the last checkpoint
+void seq_writer_seek(SeqWriter *sw, size_t idxNext, int64_t size)
+{
+    assert(!sw->zip);  // a compressed stream cannot be truncated (-resume rejects -pgn *.zst)
+    sw->idxNext = idxNext;
+    sw->size = size;
+    DIE_IF(0, ftruncate(fileno(sw->out), (off_t)size) < 0);
+    fseek(sw->out, 0, SEEK_END);
+}
 
-    if (i) {
-        // Write buf[0..i-1] to file, and destroy elements
-        for (size_t j = 0; j < i; j++) {
-            fputs(sw->buf[j].str.buf, sw->out);
-            seq_str_destroy(&sw->buf[j]);
-        }
-        fflush(sw->out);
+// Sample the writer state for a checkpoint: returns the next index the writer is waiting for, and
+// stores the size of the file content covering it (bytes flushed and accounted for) in *size
+size_t seq_writer_tell(SeqWriter *sw, int64_t *size)
+{
+    pthread_mutex_lock(&sw->mtx);
+    const size_t idxNext = sw->idxNext;
+    *size = sw->size;
+    pthread_mutex_unlock(&sw->mtx);
+    return idxNext;
+}
 
-        // Delete buf[0..i-1]
-        memmove(&sw->buf[0], &sw->buf[i], (vec_size(sw->buf) - i) * sizeof(SeqStr));
-        vec_ptr(sw->buf)->size -= i;
+void seq_writer_push(SeqWriter *sw, size_t idx, const char *bytes, size_t len)
+{
+    pthread_mutex_lock(&sw->mtx);
+    seq_writer_start(sw);
+    seq_heap_push(sw, seq_str_init(idx, bytes, len));
 
-        // Updated next expected index
-        sw->idxNext += i;
-    }
+    if (idx == sw->idxNext)
+        pthread_cond_signal(&sw->cond);
 
     pthread_mutex_unlock(&sw->mtx);
 }
@@ -13,23 +13,36 @@
  * not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <inttypes.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
-#include "str.h"
 
 typedef struct {
     size_t idx;
-    str_t str;
+    size_t len;
+    char *bytes;  // owned copy; raw bytes, not a C string (binary samples contain NUL bytes)
 } SeqStr;
 
+// Writes game results in idx order, regardless of completion order. Pushes are brief: entries go
+// into a min-heap keyed on idx, and all file I/O happens on a dedicated flusher thread, so workers
+// never block behind the PGN disk (even when one slow game stalls the sequence).
 typedef struct {
     pthread_mutex_t mtx;
-    SeqStr *buf;
+    pthread_cond_t cond;  // signals the flusher that the next expected idx arrived (or stop)
+    SeqStr *buf;  // min-heap on idx
     FILE *out;
     size_t idxNext;
+    int64_t size;  // bytes written for games below idxNext (flushed, safe to checkpoint)
+    pthread_t thread;
+    bool started, stop;
+    bool zip;  // out is a pipe to a zstd process, not a plain file
+    char pad[5];
 } SeqWriter;
 
 SeqWriter seq_writer_init(const char *fileName, const char *mode);
 void seq_writer_destroy(SeqWriter *sw);
 
-void seq_writer_push(SeqWriter *sw, size_t idx, str_t str);
+void seq_writer_seek(SeqWriter *sw, size_t idxNext, int64_t size);
+size_t seq_writer_tell(SeqWriter *sw, int64_t *size);
+void seq_writer_push(SeqWriter *sw, size_t idx, const char *bytes, size_t len);
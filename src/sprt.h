@@ -20,4 +20,7 @@ typedef struct {
 } SPRTParam;
 
 bool sprt_validate(const SPRTParam *sp);
-bool sprt_done(int wldCount[NB_RESULT], const SPRTParam *sp);
+bool sprt_done(int wldCount[NB_RESULT], const int pentaCount[5], const SPRTParam *sp,
+    bool verbose);
+double sprt_llr(int wldCount[NB_RESULT], double elo0, double elo1);
+double sprt_penta_llr(const int pentaCount[5], double elo0, double elo1);
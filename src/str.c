@@ -41,6 +41,64 @@ static size_t str_round_up(size_t n)
     }
 }
 
+// Small-block cache: most strings on the hot path are tiny (moves are 4-5 chars, tokens, option
+// names), so the two smallest allocation classes dominate the profile. A per-thread free list
+// recycles those blocks without locking, and short-lived strings stop hitting malloc() altogether.
+// An inline small-string representation was ruled out: str_t is copied by value all over (eg.
+// str_ref(), swap(), vec of str_t), which a buf pointing into the struct cannot survive. Blocks
+// are ordinary malloc() blocks, so one released on a different thread than the one that allocated
+// it is simply recycled there. Cached blocks are only reclaimed at process exit.
+enum {
+    STR_CACHE_CLASSES = 2,  // 2 and 4 machine words: 16 and 32 bytes on 64-bit
+    STR_CACHE_DEPTH = 16  // blocks kept per class, per thread (beyond that, back to free())
+};
+
+static _Thread_local struct {
+    char *block[STR_CACHE_CLASSES][STR_CACHE_DEPTH];
+    size_t count[STR_CACHE_CLASSES];
+} StrCache;
+
+static int str_cache_class(size_t alloc)
+{
+    return alloc == 2 * sizeof(size_t) ? 0 : alloc == 4 * sizeof(size_t) ? 1 : -1;
+}
+
+static char *str_block_alloc(size_t alloc)
+{
+    const int c = str_cache_class(alloc);
+
+    if (c >= 0 && StrCache.count[c])
+        return StrCache.block[c][--StrCache.count[c]];
+
+    return malloc(alloc);
+}
+
+static void str_block_free(char *buf, size_t alloc)
+{
+    const int c = buf ? str_cache_class(alloc) : -1;
+
+    if (c >= 0 && StrCache.count[c] < STR_CACHE_DEPTH)
+        StrCache.block[c][StrCache.count[c]++] = buf;
+    else
+        free(buf);
+}
+
+static char *str_block_grow(char *buf, size_t oldAlloc, size_t oldLen, size_t alloc)
+{
+    // Old block outside the cache classes: the new one is too (alloc only grows), plain realloc
+    if (buf && str_cache_class(oldAlloc) < 0)
+        return realloc(buf, alloc);
+
+    char *grown = str_block_alloc(alloc);
+
+    if (buf) {
+        memcpy(grown, buf, oldLen + 1);  // str_ok() guarantees buf[oldLen] == '\0'
+        str_block_free(buf, oldAlloc);
+    }
+
+    return grown;
+}
+
 static void str_resize(str_t *s, size_t len)
 // This function is not exposed to the API, because it does not respect the str_ok() criteria:
 // - entry: may be called with (str_t){0} or a valid string.
@@ -51,8 +109,9 @@ static void str_resize(str_t *s, size_t len)
 
     // Implement lazy realloc strategy
     if (s->alloc < str_round_up(len + 1)) {
-        s->alloc = str_round_up(len + 1);
-        s->buf = realloc(s->buf, s->alloc);
+        const size_t alloc = str_round_up(len + 1);
+        s->buf = str_block_grow(s->buf, s->alloc, s->len, alloc);
+        s->alloc = alloc;
     }
 
     s->len = len;
@@ -113,7 +172,7 @@ str_t str_init_from(const str_t src)
 
 void str_destroy(str_t *s)
 {
-    free(s->buf);
+    str_block_free(s->buf, s->alloc);
     s->buf = NULL;
 }
 
@@ -228,6 +287,11 @@ void str_cat_fmt(str_t *dest, const char *fmt, ...)
     va_end(args);
 }
 
+void str_cat_va(str_t *dest, const char *fmt, va_list args)
+{
+    do_str_cat_fmt(dest, fmt, args);
+}
+
 const char *str_tok(const char *s, str_t *token, const char *delim)
 {
     assert(str_ok(*token) && delim && *delim);
@@ -13,6 +13,7 @@
  * not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -69,6 +70,9 @@ str_t *str_cat(str_t *dest, str_t src);
 void str_cpy_fmt(str_t *dest, const char *fmt, ...);
 void str_cat_fmt(str_t *dest, const char *fmt, ...);
 
+// va_list version of str_cat_fmt(), for functions wrapping the formatter
+void str_cat_va(str_t *dest, const char *fmt, va_list args);
+
 // reads a token into valid string 'token', from s, using delim characters as a generalisation for
 // white spaces. returns tail pointer on success, otherwise NULL (no more tokens to read).
 const char *str_tok(const char *s, str_t *token, const char *delim);
@@ -0,0 +1,238 @@
+/*
+ * c-chess-cli, a command line interface for UCI chess engines. Copyright 2020 lucasart.
+ *
+ * c-chess-cli is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * c-chess-cli is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include "tb.h"
+#include "util.h"
+
+// Entry values. White is always the strong side in table space (probing mirrors the position).
+// TB_UNKNOWN only exists during generation: entries still unresolved at the fixpoint are positions
+// black can hold forever, hence draws.
+enum {TB_ILLEGAL, TB_UNKNOWN, TB_DRAW, TB_WIN};
+
+// Index: side to move, white king, white piece, black king. 512K entries of one byte per table.
+enum {TB_SIZE = 2 * 64 * 64 * 64};
+
+static uint8_t *Table[NB_PIECE];  // only QUEEN, ROOK and PAWN are generated
+
+// Upper bound, in plies, on the length of a win (to mate, or to a pawn push resetting the 50-move
+// counter): twice the max DTM of 10, 16 and 28 moves for KQvK, KRvK and KPvK respectively. Used to
+// refuse adjudicating wins that the 50-move rule could spoil.
+static const int MaxWinPly[NB_PIECE] = {[QUEEN] = 20, [ROOK] = 32, [PAWN] = 56};
+
+static size_t tb_index(int stm, int wk, int pc, int bk)
+{
+    return (size_t)(((stm * 64 + wk) * 64 + pc) * 64 + bk);
+}
+
+static bitboard_t tb_piece_attacks(int piece, int pc, bitboard_t occ)
+{
+    return piece == QUEEN ? bb_rook_attacks(pc, occ) | bb_bishop_attacks(pc, occ)
+        : piece == ROOK ? bb_rook_attacks(pc, occ)
+        : PawnAttacks[WHITE][pc];
+}
+
+static bool tb_valid(int piece, int stm, int wk, int pc, int bk)
+{
+    if (wk == pc || wk == bk || pc == bk || bb_test(KingAttacks[wk], bk))
+        return false;
+
+    if (piece == PAWN && (rank_of(pc) == RANK_1 || rank_of(pc) == RANK_8))
+        return false;  // promotions are resolved by the move that plays them
+
+    // With white to move, black must not (already) be in check
+    const bitboard_t occ = (1ULL << wk) | (1ULL << pc) | (1ULL << bk);
+    return stm == BLACK || !bb_test(tb_piece_attacks(piece, pc, occ), bk);
+}
+
+// Accumulate one child value into the move flags (TB_ILLEGAL children are not moves)
+static void tb_visit(int v, bool *anyMove, bool *anyWin, bool *allDraw)
+{
+    if (v == TB_ILLEGAL)
+        return;
+
+    *anyMove = true;
+    *anyWin = *anyWin || v == TB_WIN;
+    *allDraw = *allDraw && v == TB_DRAW;
+}
+
+// Classify a white to move entry: WIN if any move wins, DRAW if stalemated or all moves draw
+static int tb_classify_white(const uint8_t *t, const uint8_t *queenTable, int piece, int wk,
+    int pc, int bk)
+{
+    bool anyMove = false, anyWin = false, allDraw = true;
+
+    // King moves
+    bitboard_t targets = KingAttacks[wk] & ~KingAttacks[bk];
+
+    while (targets) {
+        const int to = bb_pop_lsb(&targets);
+
+        if (to != pc && to != bk)
+            tb_visit(t[tb_index(BLACK, to, pc, bk)], &anyMove, &anyWin, &allDraw);
+    }
+
+    // Piece moves
+    if (piece == PAWN) {
+        const int push = pc + UP;
+
+        if (push != wk && push != bk) {
+            if (rank_of(push) == RANK_8)
+                // Promote (to a queen: under promotions are never needed to hold a KPvK win)
+                tb_visit(queenTable[tb_index(BLACK, wk, push, bk)], &anyMove, &anyWin, &allDraw);
+            else {
+                tb_visit(t[tb_index(BLACK, wk, push, bk)], &anyMove, &anyWin, &allDraw);
+
+                const int doublePush = pc + 2 * UP;
+
+                if (rank_of(pc) == RANK_2 && doublePush != wk && doublePush != bk)
+                    tb_visit(t[tb_index(BLACK, wk, doublePush, bk)], &anyMove, &anyWin, &allDraw);
+            }
+        }
+    } else {
+        const bitboard_t occ = (1ULL << wk) | (1ULL << pc) | (1ULL << bk);
+        targets = tb_piece_attacks(piece, pc, occ) & ~(1ULL << wk);  // bk: excluded by validity
+
+        while (targets)
+            tb_visit(t[tb_index(BLACK, wk, bb_pop_lsb(&targets), bk)], &anyMove, &anyWin,
+                &allDraw);
+    }
+
+    if (!anyMove)
+        return TB_DRAW;  // white is stalemated (possible in KPvK)
+
+    return anyWin ? TB_WIN : allDraw ? TB_DRAW : TB_UNKNOWN;
+}
+
+// Classify a black to move entry: WIN if every move loses, DRAW if any move draws (capturing the
+// undefended piece, or reaching a drawn entry), mate/stalemate when there is no move at all
+static int tb_classify_black(const uint8_t *t, int piece, int wk, int pc, int bk)
+{
+    bool anyMove = false, anyDraw = false, allWin = true;
+    bitboard_t targets = KingAttacks[bk] & ~KingAttacks[wk] & ~(1ULL << wk);
+
+    while (targets) {
+        const int to = bb_pop_lsb(&targets);
+
+        // Capturing the piece leaves KvK: a draw (to is outside KingAttacks[wk], so undefended)
+        const int v = to == pc ? TB_DRAW : t[tb_index(WHITE, wk, pc, to)];
+
+        if (v == TB_ILLEGAL)
+            continue;  // moving into the piece's attacks
+
+        anyMove = true;
+        anyDraw = anyDraw || v == TB_DRAW;
+        allWin = allWin && v == TB_WIN;
+    }
+
+    if (!anyMove) {
+        const bitboard_t occ = (1ULL << wk) | (1ULL << pc) | (1ULL << bk);
+        return bb_test(tb_piece_attacks(piece, pc, occ), bk) ? TB_WIN : TB_DRAW;  // mate : stalemate
+    }
+
+    return anyDraw ? TB_DRAW : allWin ? TB_WIN : TB_UNKNOWN;
+}
+
+static void tb_generate(int piece)
+{
+    uint8_t *t = Table[piece];
+
+    for (int stm = WHITE; stm <= BLACK; stm++)
+        for (int wk = 0; wk < NB_SQUARE; wk++)
+            for (int pc = 0; pc < NB_SQUARE; pc++)
+                for (int bk = 0; bk < NB_SQUARE; bk++)
+                    t[tb_index(stm, wk, pc, bk)] = tb_valid(piece, stm, wk, pc, bk)
+                        ? TB_UNKNOWN : TB_ILLEGAL;
+
+    // Iterate to the fixpoint. Each pass resolves the positions one ply closer to a terminal, so
+    // the number of passes is bounded by the longest forced win.
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (size_t i = 0; i < TB_SIZE; i++) {
+            if (t[i] != TB_UNKNOWN)
+                continue;
+
+            const int bk = (int)(i % 64), pc = (int)(i / 64 % 64), wk = (int)(i / (64 * 64) % 64),
+                stm = (int)(i / (64 * 64 * 64));
+            const int v = stm == WHITE
+                ? tb_classify_white(t, Table[QUEEN], piece, wk, pc, bk)
+                : tb_classify_black(t, piece, wk, pc, bk);
+
+            if (v != TB_UNKNOWN) {
+                t[i] = (uint8_t)v;
+                changed = true;
+            }
+        }
+    }
+
+    // Entries the win front never reached are positions black can hold forever
+    for (size_t i = 0; i < TB_SIZE; i++)
+        if (t[i] == TB_UNKNOWN)
+            t[i] = TB_DRAW;
+}
+
+void tb_init(void)
+{
+    // Pawn last: promotions read the queen table
+    static const int pieces[3] = {QUEEN, ROOK, PAWN};
+
+    for (int i = 0; i < 3; i++) {
+        DIE_IF(0, !(Table[pieces[i]] = malloc(TB_SIZE)));
+        tb_generate(pieces[i]);
+    }
+}
+
+void tb_destroy(void)
+{
+    for (int piece = 0; piece < NB_PIECE; piece++) {
+        free(Table[piece]);
+        Table[piece] = NULL;
+    }
+}
+
+bool tb_probe(const Position *pos, int *wdl)
+{
+    if (!Table[QUEEN])
+        return false;  // -tb not in use
+
+    if (bb_count(pos_pieces(pos)) != 3 || pos->castleRooks)
+        return false;
+
+    // Mirror the board so the strong side is white in table space
+    const int strong = bb_several(pos->byColor[WHITE]) ? WHITE : BLACK;
+    const int flip = strong == BLACK ? 56 : 0;  // vertical flip, so pawns still push up
+    const int pieceSquare = bb_lsb(pos->byColor[strong] & ~pos->byPiece[KING]);
+    const int piece = pos_piece_on(pos, pieceSquare);
+
+    if (!Table[piece])
+        return false;  // KBvK and KNvK: left to the insufficient material rule
+
+    const int stm = pos->turn == strong ? WHITE : BLACK;
+    const int v = Table[piece][tb_index(stm, pos_king_square(pos, strong) ^ flip,
+        pieceSquare ^ flip, pos_king_square(pos, opposite(strong)) ^ flip)];
+    assert(v == TB_DRAW || v == TB_WIN);
+
+    if (v == TB_WIN) {
+        if (pos->rule50 + MaxWinPly[piece] > 100)
+            return false;  // the 50-move rule could spoil this win: keep playing
+
+        *wdl = stm == WHITE ? 1 : -1;
+    } else
+        *wdl = 0;
+
+    return true;
+}
@@ -0,0 +1,27 @@
+/*
+ * c-chess-cli, a command line interface for UCI chess engines. Copyright 2020 lucasart.
+ *
+ * c-chess-cli is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * c-chess-cli is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "position.h"
+
+// Exact WDL tables for the 3 men endgames that are not insufficient material: KQvK, KRvK, and
+// KPvK. Generated in process by retrograde analysis (~1.5MB, a fraction of a second), so there is
+// nothing to download and no external probing library.
+void tb_init(void);
+void tb_destroy(void);
+
+// Probe the position, if it is covered by the tables (3 men, no castling rights). On success sets
+// *wdl to the game theoretic value from the side to move's point of view (-1 loss, 0 draw, +1 win)
+// and returns true. Wins that could still be spoiled by the 50-move rule are not reported.
+bool tb_probe(const Position *pos, int *wdl);
@@ -42,6 +42,16 @@ int64_t system_msec()
     return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
 }
 
+// Full resolution variant, for the engine clocks: at very fast time controls, millisecond
+// quantization systematically over- or under-charges moves. Deliberately the same clock as
+// system_msec() (not CLOCK_MONOTONIC_RAW), so values stay comparable with the watchdog deadlines.
+int64_t system_nsec()
+{
+    struct timespec t = {0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
 void system_sleep(int64_t msec)
 {
     const struct timespec t = {.tv_sec = msec / 1000, .tv_nsec = (msec % 1000) * 1000000LL};
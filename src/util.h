@@ -37,6 +37,7 @@ uint64_t prng(uint64_t *state);
 double prngf(uint64_t *state);
 
 int64_t system_msec(void);
+int64_t system_nsec(void);  // same clock as system_msec(), at full resolution
 void system_sleep(int64_t msec);
 
 #define DIE(...) do { \
@@ -12,13 +12,168 @@
  * You should have received a copy of the GNU General Public License along with this program. If
  * not, see <http://www.gnu.org/licenses/>.
 */
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "workers.h"
 #include "util.h"
 #include "vec.h"
 
 Worker *Workers;
 
+static pthread_t logThread;
+static atomic_bool logStarted, logStop;
+
+// Deadline watchdog: one thread sleeps until the earliest registered deadline could be overdue,
+// instead of polling every worker at a fixed interval. deadline_set() pushes an entry into a
+// min-heap; deadline_clear() invalidates lazily, by just bumping the worker's sequence number, so
+// the per-move hot path never touches the heap. Stale entries are discarded when they surface.
+typedef struct {
+    int64_t expiry;  // when the deadline becomes unrecoverable (timeLimit + tolerance)
+    uint64_t seq;  // copy of w->deadline.seq at push time: entry is stale if it no longer matches
+    int id;  // index in Workers[]
+    char pad[4];
+} DeadlineEntry;
+
+static struct {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    DeadlineEntry *heap;  // binary min-heap on expiry
+    pthread_t thread;
+    bool started, stop;
+    char pad[6];
+} watchdog;
+
+// We want some tolerance on small delays here. Given a choice, it's best to wait for the worker
+// thread to notice an overdue deadline, which it will handle nicely by counting the game as lost
+// for the offending engine, and continue. Enforcing deadlines from the watchdog is the last resort
+// solution, because it is an unrecovrable error. At this point we are likely to face a completely
+// unresponsive engine, where any attempt at I/O will block the worker. Hence, we must DIE().
+#define DEADLINE_TOLERANCE 1000
+
+static void watchdog_push(DeadlineEntry e)
+{
+    vec_push(watchdog.heap, e);
+    size_t i = vec_size(watchdog.heap) - 1;
+
+    while (i && watchdog.heap[(i - 1) / 2].expiry > watchdog.heap[i].expiry) {
+        swap(watchdog.heap[i], watchdog.heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+}
+
+static void watchdog_pop(void)
+{
+    const size_t n = vec_size(watchdog.heap) - 1;
+    watchdog.heap[0] = watchdog.heap[n];
+    vec_ptr(watchdog.heap)->size = n;
+
+    size_t i = 0;
+
+    while (true) {
+        const size_t l = 2 * i + 1, r = 2 * i + 2;
+        size_t min = i;
+
+        if (l < n && watchdog.heap[l].expiry < watchdog.heap[min].expiry)
+            min = l;
+
+        if (r < n && watchdog.heap[r].expiry < watchdog.heap[min].expiry)
+            min = r;
+
+        if (min == i)
+            break;
+
+        swap(watchdog.heap[i], watchdog.heap[min]);
+        i = min;
+    }
+}
+
+static void *watchdog_loop(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&watchdog.mtx);
+
+    while (!watchdog.stop) {
+        if (!vec_size(watchdog.heap)) {
+            pthread_cond_wait(&watchdog.cond, &watchdog.mtx);
+            continue;
+        }
+
+        const DeadlineEntry e = watchdog.heap[0];
+
+        // Purge cancelled entries as they surface at the root, without waiting for their expiry.
+        // Depth/nodes-limited games push an effectively infinite deadline per move: sleeping on
+        // those would leak one heap entry per move for the whole run.
+        Worker *w = &Workers[e.id];
+        pthread_mutex_lock(&w->deadline.mtx);
+        const bool stale = w->deadline.seq != e.seq;
+        pthread_mutex_unlock(&w->deadline.mtx);
+
+        if (stale) {
+            watchdog_pop();
+            continue;
+        }
+
+        const int64_t now = system_msec();
+
+        if (e.expiry > now) {
+            // Sleep until the earliest deadline could be overdue, or an earlier one arrives
+            const struct timespec until = {
+                .tv_sec = e.expiry / 1000,
+                .tv_nsec = e.expiry % 1000 * 1000000
+            };
+            pthread_cond_timedwait(&watchdog.cond, &watchdog.mtx, &until);
+            continue;
+        }
+
+        // Still armed, and past tolerance: the engine is hopelessly stuck
+        pthread_mutex_unlock(&watchdog.mtx);
+        DIE("[%d] engine %s is unresponsive\n", w->id, w->deadline.engineName.buf);
+    }
+
+    pthread_mutex_unlock(&watchdog.mtx);
+    return NULL;
+}
+
+void workers_watchdog_start(void)
+{
+    pthread_mutex_init(&watchdog.mtx, NULL);
+
+    // The condvar must tick on the same clock as system_msec()
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watchdog.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    watchdog.heap = vec_init(DeadlineEntry);
+    watchdog.started = true;
+    pthread_create(&watchdog.thread, NULL, watchdog_loop, NULL);
+}
+
+void workers_watchdog_stop(void)
+{
+    if (!watchdog.started)
+        return;
+
+    // DIE() path: exit() was called from the watchdog itself, don't join ourselves
+    if (pthread_equal(pthread_self(), watchdog.thread))
+        return;
+
+    watchdog.started = false;
+
+    pthread_mutex_lock(&watchdog.mtx);
+    watchdog.stop = true;
+    pthread_cond_signal(&watchdog.cond);
+    pthread_mutex_unlock(&watchdog.mtx);
+
+    pthread_join(watchdog.thread, NULL);
+    vec_destroy(watchdog.heap);
+    pthread_cond_destroy(&watchdog.cond);
+    pthread_mutex_destroy(&watchdog.mtx);
+}
+
 void deadline_set(Worker *w, const char *engineName, int64_t timeLimit)
 {
     assert(timeLimit > 0);
@@ -26,14 +181,30 @@ void deadline_set(Worker *w, const char *engineName, int64_t timeLimit)
     pthread_mutex_lock(&w->deadline.mtx);
 
     w->deadline.set = true;
+    const uint64_t seq = ++w->deadline.seq;
     str_cpy_c(&w->deadline.engineName, engineName);
     w->deadline.timeLimit = timeLimit;
 
     pthread_mutex_unlock(&w->deadline.mtx);
 
-    if (w->log)
-        DIE_IF(w->id, fprintf(w->log, "deadline: %s must respond by %" PRId64 "\n", engineName,
-            timeLimit) < 0);
+    if (watchdog.started) {
+        const DeadlineEntry e = {
+            .expiry = timeLimit + DEADLINE_TOLERANCE,
+            .seq = seq,
+            .id = w->id - 1
+        };
+
+        pthread_mutex_lock(&watchdog.mtx);
+        watchdog_push(e);
+
+        // New earliest deadline: re-arm the sleeping watchdog
+        if (watchdog.heap[0].expiry == e.expiry)
+            pthread_cond_signal(&watchdog.cond);
+
+        pthread_mutex_unlock(&watchdog.mtx);
+    }
+
+    worker_log(w, "deadline: %s must respond by %I\n", engineName, (intmax_t)timeLimit);
 }
 
 void deadline_clear(Worker *w)
@@ -41,38 +212,98 @@ void deadline_clear(Worker *w)
     pthread_mutex_lock(&w->deadline.mtx);
 
     w->deadline.set = false;
-
-    if (w->log)
-        DIE_IF(w->id, fprintf(w->log, "deadline: %s responded before %" PRId64 "\n",
-            w->deadline.engineName.buf, w->deadline.timeLimit) < 0);
+    w->deadline.seq++;
 
     pthread_mutex_unlock(&w->deadline.mtx);
+
+    worker_log(w, "deadline: %s responded before %I\n", w->deadline.engineName.buf,
+        (intmax_t)w->deadline.timeLimit);
 }
 
-int64_t deadline_overdue(Worker *w)
+void worker_log(Worker *w, const char *fmt, ...)
 {
-    pthread_mutex_lock(&w->deadline.mtx);
+    if (!w->log)
+        return;
 
-    const int64_t timeLimit = w->deadline.timeLimit;
-    const bool set = w->deadline.set;
+    pthread_mutex_lock(&w->logBuf.mtx);
 
-    pthread_mutex_unlock(&w->deadline.mtx);
+    va_list args;
+    va_start(args, fmt);
+    str_cat_va(&w->logBuf.buf, fmt, args);
+    va_end(args);
+
+    pthread_mutex_unlock(&w->logBuf.mtx);
+}
+
+static void worker_log_flush(Worker *w)
+// Writes out buffered log lines. File I/O happens outside the buffer lock, so workers never block
+// on the log disk.
+{
+    if (!w->log)
+        return;
+
+    scope(str_destroy) str_t pending = str_init();
 
-    const int64_t time = system_msec();
+    pthread_mutex_lock(&w->logBuf.mtx);
+    swap(pending, w->logBuf.buf);
+    pthread_mutex_unlock(&w->logBuf.mtx);
 
-    if (set && time > timeLimit)
-        return time - timeLimit;
-    else
-        return 0;
+    if (pending.len) {
+        DIE_IF(0, fputs(pending.buf, w->log) < 0);
+        DIE_IF(0, fflush(w->log) < 0);
+    }
+}
+
+static void *log_flusher(void *arg)
+{
+    (void)arg;
+
+    while (true) {
+        const bool stop = atomic_load(&logStop);
+
+        for (size_t i = 0; i < vec_size(Workers); i++)
+            worker_log_flush(&Workers[i]);
+
+        if (stop)
+            return NULL;
+
+        system_sleep(200);
+    }
 }
 
-Worker worker_init(int i, const char *logName)
+void workers_log_start(void)
+{
+    atomic_store(&logStarted, true);
+    pthread_create(&logThread, NULL, log_flusher, NULL);
+}
+
+void workers_log_stop(void)
+{
+    if (atomic_exchange(&logStarted, false)) {
+        atomic_store(&logStop, true);
+        pthread_join(logThread, NULL);
+    }
+}
+
+Worker worker_init(int i, const char *logName, bool affinity)
 {
     Worker w = {0};
     w.seed = (uint64_t)i;
     w.id = i + 1;
+    w.cpus[0] = w.cpus[1] = -1;
+
+    if (affinity) {
+        // Give each worker a dedicated pair of consecutive cpus, one per engine slot. Linux
+        // enumerates cpus node-major, so consecutive ids share a socket/NUMA node on the usual
+        // topologies. Wraps around when concurrency exceeds half the cpu count.
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        w.cpus[0] = (int)(2 * i % cores);
+        w.cpus[1] = (int)((2 * i + 1) % cores);
+    }
     pthread_mutex_init(&w.deadline.mtx, NULL);
     w.deadline.engineName = str_init();
+    pthread_mutex_init(&w.logBuf.mtx, NULL);
+    w.logBuf.buf = str_init();
 
     if (*logName) {
         w.log = fopen(logName, "we");
@@ -84,8 +315,12 @@ Worker worker_init(int i, const char *logName)
 
 void worker_destroy(Worker *w)
 {
+    worker_log_flush(w);  // the flusher thread is stopped by now: write out what remains
+
     str_destroy(&w->deadline.engineName);
     pthread_mutex_destroy(&w->deadline.mtx);
+    str_destroy(&w->logBuf.buf);
+    pthread_mutex_destroy(&w->logBuf.mtx);
 
     if (w->log) {
         DIE_IF(0, fclose(w->log) < 0);
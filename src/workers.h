@@ -32,24 +32,39 @@ typedef struct {
     struct {
         pthread_mutex_t mtx;
         int64_t timeLimit;
+        uint64_t seq;  // bumped on every set/clear, to lazily invalidate watchdog heap entries
         str_t engineName;
         bool set;
         char pad[7];
     } deadline;
+    struct {
+        pthread_mutex_t mtx;
+        str_t buf;  // lines pending, drained by the log flusher thread
+    } logBuf;
     FILE *log;
     uint64_t seed;  // seed for prng()
     int id;  // starts at 1 (0 is for main thread)
+    int cpus[2];  // with -affinity: dedicated cpu per engine slot (-1 otherwise)
     char pad[4];
 } Worker;
 
 extern Worker *Workers;
 
-Worker worker_init(int id, const char *logName);
+Worker worker_init(int id, const char *logName, bool affinity);
 void worker_destroy(Worker *w);
 
 void deadline_set(Worker *w, const char *engineName, int64_t timeLimit);
 void deadline_clear(Worker *w);
-int64_t deadline_overdue(Worker *w);
 
-void workers_busy_add(int n);
-int workers_busy_count(void);
+// Appends a line to the worker's log buffer (no-op if logging is off). Uses str_cat_fmt()
+// formats. Buffered lines reach the log file when the flusher thread drains them, keeping
+// syscalls off the worker's hot path.
+void worker_log(Worker *w, const char *fmt, ...);
+
+void workers_log_start(void);
+void workers_log_stop(void);
+
+// Deadline watchdog: a thread that sleeps until the earliest registered deadline could be overdue,
+// and kills the tournament when an engine is unresponsive past recovery.
+void workers_watchdog_start(void);
+void workers_watchdog_stop(void);
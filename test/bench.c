@@ -0,0 +1,245 @@
+/*
+ * c-chess-cli, a command line interface for UCI chess engines. Copyright 2020 lucasart.
+ *
+ * c-chess-cli is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * c-chess-cli is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <http://www.gnu.org/licenses/>.
+*/
+// Stand alone program: microbenchmarks for the tester's hot kernels (build with make.py -p bench).
+// Each kernel runs over a corpus derived from test/chess960.epd for a fixed wall-clock budget, and
+// reports throughput plus a checksum ('sig'), which must not change across optimization patches —
+// only the numbers should. Run it from the repository root.
+#include <string.h>
+#include <time.h>
+#include "gen.h"
+#include "seqwriter.h"
+#include "str.h"
+#include "util.h"
+#include "vec.h"
+
+#define BUDGET_NS 200000000LL  // wall clock budget per kernel
+
+static int64_t now_ns(void)
+{
+    struct timespec t = {0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void report(const char *name, size_t ops, int64_t ns, uint64_t sig)
+{
+    printf("%-16s %10.2f Mops/s %9.1f ns/op  sig=%016" PRIx64 "\n", name,
+        (double)ops * 1000.0 / (double)ns, (double)ns / (double)ops, sig);
+}
+
+static str_t *load_fens(const char *fileName)
+{
+    FILE *in = fopen(fileName, "re");
+    DIE_IF(0, !in);
+
+    str_t *fens = vec_init(str_t);
+    scope(str_destroy) str_t line = str_init(), fen = str_init();
+
+    while (vec_size(fens) < 200 && str_getline(&line, in))
+        if (str_tok(line.buf, &fen, ";"))
+            vec_push(fens, str_init_from(fen));
+
+    fclose(in);
+    return fens;
+}
+
+// Expand the FEN corpus into middlegame positions, with deterministic random playouts
+static Position *make_corpus(const str_t *fens)
+{
+    Position *corpus = vec_init_reserve(4096, Position);
+    move_t *moves = vec_init_reserve(64, move_t);
+    uint64_t seed = 0;
+
+    for (size_t i = 0; i < vec_size(fens); i++) {
+        Position pos = {0};
+        DIE_IF(0, !pos_set(&pos, fens[i].buf, false, NULL));
+
+        for (int ply = 0; ply < 24; ply++) {
+            vec_push(corpus, pos);
+            moves = gen_all_moves(&pos, moves);
+
+            if (!vec_size(moves) || pos.rule50 >= 100)
+                break;
+
+            Position next = {0};
+            pos_move(&next, &pos, moves[prng(&seed) % vec_size(moves)]);
+            pos = next;
+            vec_clear(moves);
+        }
+    }
+
+    vec_destroy(moves);
+    return corpus;
+}
+
+static void bench_pos_set(const str_t *fens)
+{
+    const int64_t start = now_ns();
+    int64_t elapsed = 0;
+    size_t ops = 0;
+    uint64_t sig = 0;
+
+    while ((elapsed = now_ns() - start) < BUDGET_NS) {
+        sig = 0;  // per-pass checksum: identical on every pass, so the report is run-stable
+
+        for (size_t i = 0; i < vec_size(fens); i++, ops++) {
+            Position pos = {0};
+            pos_set(&pos, fens[i].buf, false, NULL);
+            sig += pos.key;
+        }
+    }
+
+    report("pos_set", ops, elapsed, sig);
+}
+
+static void bench_gen_all_moves(const Position *corpus)
+{
+    move_t *moves = vec_init_reserve(64, move_t);
+    const int64_t start = now_ns();
+    int64_t elapsed = 0;
+    size_t ops = 0;
+    uint64_t sig = 0;
+
+    while ((elapsed = now_ns() - start) < BUDGET_NS) {
+        sig = 0;
+
+        for (size_t i = 0; i < vec_size(corpus); i++, ops++) {
+            vec_clear(moves);
+            moves = gen_all_moves(&corpus[i], moves);
+            sig += vec_size(moves);
+        }
+    }
+
+    vec_destroy(moves);
+    report("gen_all_moves", ops, elapsed, sig);
+}
+
+static void bench_pos_move(const Position *corpus)
+{
+    move_t *moves = vec_init_reserve(64, move_t);
+    const int64_t start = now_ns();
+    int64_t elapsed = 0;
+    size_t ops = 0;
+    uint64_t sig = 0;
+
+    while ((elapsed = now_ns() - start) < BUDGET_NS) {
+        sig = 0;
+
+        for (size_t i = 0; i < vec_size(corpus); i++) {
+            vec_clear(moves);
+            moves = gen_all_moves(&corpus[i], moves);
+
+            for (size_t m = 0; m < vec_size(moves); m++, ops++) {
+                Position next = {0};
+                pos_move(&next, &corpus[i], moves[m]);
+                sig += next.key;
+            }
+        }
+    }
+
+    vec_destroy(moves);
+    report("pos_move", ops, elapsed, sig);
+}
+
+static void bench_pos_move_to_san(const Position *corpus)
+{
+    move_t *moves = vec_init_reserve(64, move_t);
+    scope(str_destroy) str_t san = str_init();
+    const int64_t start = now_ns();
+    int64_t elapsed = 0;
+    size_t ops = 0;
+    uint64_t sig = 0;
+
+    while ((elapsed = now_ns() - start) < BUDGET_NS) {
+        sig = 0;
+
+        for (size_t i = 0; i < vec_size(corpus); i++) {
+            vec_clear(moves);
+            moves = gen_all_moves(&corpus[i], moves);
+
+            for (size_t m = 0; m < vec_size(moves); m++, ops++) {
+                pos_move_to_san(&corpus[i], moves[m], &san);
+                sig += san.len;
+            }
+        }
+    }
+
+    vec_destroy(moves);
+    report("pos_move_to_san", ops, elapsed, sig);
+}
+
+static void bench_str_cat_fmt(void)
+{
+    scope(str_destroy) str_t out = str_init();
+    const int64_t start = now_ns();
+    int64_t elapsed = 0;
+    size_t ops = 0;
+    uint64_t sig = 0;
+
+    while ((elapsed = now_ns() - start) < BUDGET_NS) {
+        sig = 0;
+
+        for (int i = 0; i < 1000; i++, ops++) {
+            str_cpy_fmt(&out, "info depth %i score cp %i nodes %I pv %s", i, -i,
+                (intmax_t)i * 1000000, "e2e4 e7e5 g1f3");
+            sig += out.len;
+        }
+    }
+
+    report("str_cat_fmt", ops, elapsed, sig);
+}
+
+static void bench_seq_writer_push(void)
+{
+    // A typical PGN-sized payload, pushed in a scrambled order so the heap actually works
+    scope(str_destroy) str_t payload = str_init();
+
+    while (payload.len < 2048)
+        str_cat_c(&payload, "1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 {+0.25/20 1.2s} ");
+
+    const int64_t start = now_ns();
+    int64_t elapsed = 0;
+    size_t ops = 0;
+
+    while ((elapsed = now_ns() - start) < BUDGET_NS) {
+        SeqWriter sw = seq_writer_init("/dev/null", "we");
+        const size_t n = 4096;
+
+        for (size_t i = 0; i < n; i++, ops++)
+            seq_writer_push(&sw, i * 257 % n, payload.buf, payload.len);  // 257, 4096 coprime
+
+        seq_writer_destroy(&sw);
+    }
+
+    report("seq_writer_push", ops, elapsed, 0);
+}
+
+int main(void)
+{
+    str_t *fens = load_fens("test/chess960.epd");
+    Position *corpus = make_corpus(fens);
+    printf("corpus: %zu positions from %zu openings\n", vec_size(corpus), vec_size(fens));
+
+    bench_pos_set(fens);
+    bench_gen_all_moves(corpus);
+    bench_pos_move(corpus);
+    bench_pos_move_to_san(corpus);
+    bench_str_cat_fmt();
+    bench_seq_writer_push();
+
+    vec_destroy(corpus);
+    vec_destroy_rec(fens, str_destroy);
+    return 0;
+}